@@ -1,90 +1,208 @@
+#include <math.h> //For the floating point altitude and sea level pressure functions
 #include "BMP180.h" //Include the definitions of functions and many other necessary things
 
+#if BMP180_EEPROM_CACHE
+/*
+* The copy of the calibration values kept at the EEPROM
+* It is used only if the chip id matches the connected sensor and the checksum matches the stored bytes
+*/
+typedef struct
+{
+	uint8_t chip_id; //The chip id of the sensor that the values were read from
+	uint8_t calib_bytes[CALIB_BYTES_COUNT]; //The calibration bytes as read from the sensor
+	uint16_t checksum; //Fletcher-16 checksum of the chip id and the calibration bytes
+} BMP180_Calib_Cache;
+
+BMP180_Calib_Cache EEMEM bmp180_calib_cache[BMP180_EEPROM_CACHE_SLOTS]; //The places of the copies at the EEPROM, one for each sensor
+#endif
+
+#if !TWI_FREQ_VALID(BMP180_TWI_FREQ)
+#error "BMP180_TWI_FREQ must be up to 400kHz and between F_CPU/(16 + 2*255*64) and F_CPU/16"
+#endif
+
 //Internal function prototypes
-void BMP180_Read_Bytes(uint8_t registe, uint8_t *byte_read, uint8_t byte_count);
-void BMP180_Get_Calibration_Params(void);
-uint16_t BMP180_Read_Temp_Raw(void);
-int32_t BMP180_Read_Press_Raw(void);
+uint8_t BMP180_Check(BMP180_Dev *dev, uint8_t error);
+uint8_t BMP180_Send_Command(BMP180_Dev *dev, uint8_t command_register, uint8_t command);
+uint8_t BMP180_Read_Bytes(BMP180_Dev *dev, uint8_t registe, uint8_t *byte_read, uint8_t byte_count);
+uint8_t BMP180_Get_Calibration_Params(BMP180_Dev *dev);
+uint8_t BMP180_Read_Temp_Raw(BMP180_Dev *dev, uint16_t *UT);
+uint8_t BMP180_Read_Press_Raw(BMP180_Dev *dev, int32_t *UP);
+uint8_t BMP180_Poll_Failed(BMP180_Dev *dev);
+void BMP180_Unpack_Calibration(BMP180_Dev *dev, const uint8_t *calib_bytes);
+uint8_t BMP180_Temp_Due(BMP180_Dev *dev);
+int16_t BMP180_Calc_Temp(BMP180_Dev *dev, uint16_t UT);
+void BMP180_Update_Press_Terms(BMP180_Dev *dev);
+int32_t BMP180_Filter_Update(BMP180_Dev *dev, int32_t pressure);
+uint32_t BMP180_Mul_Q30(uint32_t a, uint32_t b);
+uint32_t BMP180_Div_Shift(uint32_t num, uint32_t den, uint8_t shift);
+int32_t BMP180_Calc_Pressure(BMP180_Dev *dev, int32_t UP);
+
+/*
+* The bus functions return TWI_OK or the TWI_ERR_ value of the failure, which is also kept at dev->error
+* In the queue mode the failure of a transaction is known when it is waited for
+*/
+#if TWI_ASYNC_ENABLE
+#define BMP180_Wait_Command(dev) BMP180_Check(dev, TWIWait(&(dev)->command_trans)) //Wait until the last command has reached the sensor
+#define BMP180_Wait_Read(dev) BMP180_Check(dev, TWIWait(&(dev)->read_trans)) //Wait until the bytes of the last read have arrived
+#else
+#define BMP180_Wait_Command(dev) TWI_OK //The blocking functions return after the command is sent
+#define BMP180_Wait_Read(dev) TWI_OK //The blocking functions return with the bytes already received
+#endif
+
+/*
+* Keep the error of a bus function at the device and return it
+*/
+uint8_t BMP180_Check(BMP180_Dev *dev, uint8_t error)
+{
+	if (error)
+		dev->error = error;
+	return error;
+}
 
 /*
 * Write the desired command to the sensor via I2C
 * Provide the address of the command register and then provide the command to be sent via I2C
 */
-inline void BMP180_Send_Command(uint8_t command_register, uint8_t command)
+uint8_t BMP180_Send_Command(BMP180_Dev *dev, uint8_t command_register, uint8_t command)
 {
-	while ((TWCR & (1 << TWINT))); //Wait if the bus is busy
-	TWIStart(); //Send a start condition to initialize communication
-	TWIWrite(BMP180_WRITE); //Send the write command to the sensor memory
-	TWIWrite(command_register); //Send the register address for the command to be sent
-	TWIWrite(command); //The wanted command is sent
-	TWIStop(); //Stop the I2C communication
+#if TWI_ASYNC_ENABLE
+	TWIWait(&dev->command_trans); //The previous command must leave the queue before its descriptor is used again
+	dev->command_bytes[0] = command_register;
+	dev->command_bytes[1] = command;
+	dev->command_trans.address = dev->address;
+	dev->command_trans.write_data = dev->command_bytes;
+	dev->command_trans.write_count = 2;
+	dev->command_trans.read_count = 0;
+	dev->command_trans.callback = 0;
+	dev->command_trans.speed = TWI_SPEED(BMP180_TWI_FREQ);
+	while (!TWISubmit(&dev->command_trans)) //Wait only for a free place in the queue and not for the bus
+		TWIWaitFree();
+	return TWI_OK;
+#else
+	TWISetSpeed(TWI_SPEED(BMP180_TWI_FREQ));
+	return BMP180_Check(dev, TWIWriteRegs(dev->address, command_register, &command, 1)); //Send the command to the command register in one transaction
+#endif
 }
 
 /*
 * Read the bytes sent from the sensor via I2C
 * Provide the address of the read register and also provide the number of the expected bytes and the array for the read bytes to be saved
+* When TWI_ASYNC_ENABLE is set, the function returns as soon as the read is queued and BMP180_Wait_Read(dev) waits for the bytes
 */
-void BMP180_Read_Bytes(uint8_t registe, uint8_t *byte_read, uint8_t byte_count)
+uint8_t BMP180_Read_Bytes(BMP180_Dev *dev, uint8_t registe, uint8_t *byte_read, uint8_t byte_count)
 {
-	while ((TWCR & (1 << TWINT))); //Wait if the bus is busy
-	TWIStart(); //Send a start condition to initialize communication
-	TWIWrite(BMP180_WRITE); //Send the write command to the sensor memory
-	TWIWrite(registe); //Send the register you want
-	
-	//TWI Restart condition
-	TWIStop();
-	TWIStart();
+#if TWI_ASYNC_ENABLE
+	TWIWait(&dev->read_trans); //The previous read must leave the queue before its descriptor is used again
+	dev->read_register = registe;
+	dev->read_trans.address = dev->address;
+	dev->read_trans.write_data = &dev->read_register;
+	dev->read_trans.write_count = 1;
+	dev->read_trans.read_data = byte_read;
+	dev->read_trans.read_count = byte_count;
+	dev->read_trans.callback = 0;
+	dev->read_trans.speed = TWI_SPEED(BMP180_TWI_FREQ);
+	while (!TWISubmit(&dev->read_trans)) //Wait only for a free place in the queue and not for the bus
+		TWIWaitFree();
+	return TWI_OK;
+#else
+	TWISetSpeed(TWI_SPEED(BMP180_TWI_FREQ));
+	return BMP180_Check(dev, TWIReadRegs(dev->address, registe, byte_read, byte_count)); //Send the register you want and read the returned bytes after a repeated start
+#endif
+}
+
+/*
+* Save the read calibration bytes to the calibration variables, the MSB of each parameter is first and its LSB after it
+*/
+void BMP180_Unpack_Calibration(BMP180_Dev *dev, const uint8_t *calib_bytes)
+{
+	for(uint8_t i = 0; i < 11; i++)
+	{
+		if(i == AC4) //Store the AC4 value in a separate variable, because it is unsigned
+			dev->ac4_reg = ((uint32_t)calib_bytes[2*i] << 8) | ((uint32_t)calib_bytes[2*i + 1]);
+		else
+			dev->calibration_values[i] = ((int16_t)calib_bytes[2*i] << 8) | ((int16_t)calib_bytes[2*i + 1]); //Save the value to the corresponding place at the array
+	}
+}
+
+#if BMP180_EEPROM_CACHE
+/*
+* Calculate the checksum of the chip id and the calibration bytes of the EEPROM copy
+*/
+uint16_t BMP180_Cache_Checksum(const BMP180_Calib_Cache *cache)
+{
+	uint8_t sum1 = cache->chip_id, sum2 = cache->chip_id; //Start with the chip id already added
 	
-	TWIWrite(BMP180_READ); //Send the read command to the sensor
-	for(uint8_t i = 0; i < byte_count; i++) //and read the returned bytes
+	for (uint8_t i = 0; i < CALIB_BYTES_COUNT; i++)
 	{
-		if (i == byte_count - 1) {byte_read[i] = TWIReadNACK();} //When the last byte is to be received, don't acknowledge to the slave
-		else {byte_read[i] = TWIReadACK();} //If the bytes that are expected are more than one, send an acknowledgment to the slave
+		sum1 = ((uint16_t)sum1 + cache->calib_bytes[i]) % 255;
+		sum2 = ((uint16_t)sum2 + sum1) % 255;
 	}
-	TWIStop(); //Stop the I2C communication
+	return (((uint16_t)sum2 << 8) | sum1);
 }
+#endif
 
 /*
 * Read the calibration parameters from the BMP memory
+* All the parameters are read at once, because their registers are consecutive, from 0xAA to 0xBF
+* If the EEPROM cache is enabled and the copy at the cache slot of the device belongs to the connected sensor, the values are taken from there instead
+* Returns TWI_OK, or the error of the bus with the calibration values left as they were
 */
-void BMP180_Get_Calibration_Params(void)
+uint8_t BMP180_Get_Calibration_Params(BMP180_Dev *dev)
 {
-	uint8_t reg_read = FIRST_CALIB_REG_ADDR; //Set the address of the first parameter register
-	uint8_t temp_value[2]; //Store the read MSB at index (0) and LSB at index (1) temporarily
+	#if BMP180_EEPROM_CACHE
+		BMP180_Calib_Cache cache;
+		uint8_t chip_id;
 		
-	for(uint8_t i = 0; i < 11; i++)
-	{
-		if(reg_read == 0xB0) //Store the AC4 value in a separate variable
+		if (BMP180_Read_Bytes(dev, CHIP_ID_REG, &chip_id, 1) || BMP180_Wait_Read(dev)) //The chip id is the sensor signature, which also tells if a sensor is there
+			return dev->error;
+		eeprom_read_block(&cache, &bmp180_calib_cache[dev->cache_slot], sizeof(cache));
+		
+		if ((cache.chip_id == chip_id) && (cache.checksum == BMP180_Cache_Checksum(&cache))) //The copy is valid, so use it
 		{
-			BMP180_Read_Bytes(reg_read, temp_value, 2); //Expect to read two bytes form the corresponding register, first MSB and second LSB
-			_ac4_reg = ((uint32_t)temp_value[0] << 8) | ((uint32_t)temp_value[1]); //Save the value of AC4 to the variable
-			reg_read += 2; //Increment for the next register
-			continue; //Continue the loop from here and on
+			BMP180_Unpack_Calibration(dev, cache.calib_bytes);
+			return TWI_OK;
 		}
-		BMP180_Read_Bytes(reg_read, temp_value, 2); //Expect to read two bytes form the corresponding register, first MSB and second LSB
-		calibration_values[i] = ((int16_t)temp_value[0] << 8) | ((int16_t)temp_value[1]); //Save the read value to the corresponding place at the array
-		reg_read += 2; //Increment to go to the next register
-	}
+		
+		//The copy is missing or damaged, read the values from the sensor and save them for the next start up
+		if (BMP180_Read_Bytes(dev, FIRST_CALIB_REG_ADDR, cache.calib_bytes, CALIB_BYTES_COUNT) || BMP180_Wait_Read(dev))
+			return dev->error;
+		cache.chip_id = chip_id;
+		cache.checksum = BMP180_Cache_Checksum(&cache);
+		eeprom_update_block(&cache, &bmp180_calib_cache[dev->cache_slot], sizeof(cache)); //Only the changed bytes are written, to save EEPROM wear
+		BMP180_Unpack_Calibration(dev, cache.calib_bytes);
+	#else
+		uint8_t calib_bytes[CALIB_BYTES_COUNT]; //The read bytes, with the MSB of each parameter first and its LSB after it
+		
+		if (BMP180_Read_Bytes(dev, FIRST_CALIB_REG_ADDR, calib_bytes, CALIB_BYTES_COUNT) || BMP180_Wait_Read(dev))
+			return dev->error;
+		BMP180_Unpack_Calibration(dev, calib_bytes);
+	#endif
+	return TWI_OK;
 }
 
 /*
 * Read the raw temperature value as the sensor has calculated and has it saved at its memory registers
+* The value, a 16-bit integer, is saved at (UT) and the function returns TWI_OK, or the error of the bus with (UT) left as it was
 */
-uint16_t BMP180_Read_Temp_Raw(void)
+uint8_t BMP180_Read_Temp_Raw(BMP180_Dev *dev, uint16_t *UT)
 {
 	uint8_t bytes[2]; //Array to store the returned bytes from the BMP180_Read_Bytes() function
 	
-	BMP180_Send_Command(RAW_VALUE_READ_REGISTER, TEMP_READ_COMMAND); //Send the command to tell the sensor to calculate the raw temperature value
+	if (BMP180_Send_Command(dev, RAW_VALUE_READ_REGISTER, TEMP_READ_COMMAND) || BMP180_Wait_Command(dev)) //Send the command to tell the sensor to calculate the raw temperature value, its conversion time counts from the moment it reaches the sensor
+		return dev->error;
 	_delay_ms(5); //Delay 5ms, because the sensor takes a maximum of 4.5ms to make the measurement of the temperature
-	BMP180_Read_Bytes(TEMP_READ_UNCL_MSB, bytes, 2); //Once measured, read the raw temperature value from the sensor's registers
+	if (BMP180_Read_Bytes(dev, TEMP_READ_UNCL_MSB, bytes, 2) || BMP180_Wait_Read(dev)) //Once measured, read the raw temperature value from the sensor's registers
+		return dev->error;
 	
-	return (((uint16_t)bytes[0] << 8) | ((uint16_t)bytes[1])); //Return the raw value which is a 16-bit integer
+	*UT = ((uint16_t)bytes[0] << 8) | ((uint16_t)bytes[1]);
+	return TWI_OK;
 }
 
 /*
 * Read the raw pressure value as the sensor has calculated and has it saved at its memory registers
+* The value is saved at (UP) and the function returns TWI_OK, or the error of the bus with (UP) left as it was
 */
-int32_t BMP180_Read_Press_Raw(void)
+uint8_t BMP180_Read_Press_Raw(BMP180_Dev *dev, int32_t *UP)
 {
 	//Array to store the bits read from the registers. In sequence, at index (0) is the MSB, at index (1) the LSB and at index (2) is the XLSB
 	uint8_t bytes[3];
@@ -93,101 +211,235 @@ int32_t BMP180_Read_Press_Raw(void)
 	* Send the command to tell the sensor to calculate the raw pressure value
 	* and also calibrate the read command according to the selected value resolution (this part is the shifting, which is (PRESS_RESOLUTION << 6))
 	*/
-	BMP180_Send_Command(RAW_VALUE_READ_REGISTER, PRESS_READ_COMMAND + (PRESS_RESOLUTION << 6));
+	if (BMP180_Send_Command(dev, RAW_VALUE_READ_REGISTER, PRESS_READ_COMMAND + (PRESS_RESOLUTION << 6)) || BMP180_Wait_Command(dev)) //The conversion time counts from the moment the command reaches the sensor
+		return dev->error;
 	_delay_ms(2 + (3 << PRESS_RESOLUTION)); //Delay a set amount of time, according to the selected value resolution
-	BMP180_Read_Bytes(PRESS_READ_UNCL_MSB, bytes, 3); //And read the measured raw pressure value
+	if (BMP180_Read_Bytes(dev, PRESS_READ_UNCL_MSB, bytes, 3) || BMP180_Wait_Read(dev)) //And read the measured raw pressure value
+		return dev->error;
 	
-	return ((((int32_t)bytes[0] << 16) | ((int32_t)bytes[1] << 8) | ((int32_t)bytes[2])) >> (8 - PRESS_RESOLUTION)); //Return the read value
+	*UP = (((int32_t)bytes[0] << 16) | ((int32_t)bytes[1] << 8) | ((int32_t)bytes[2])) >> (8 - PRESS_RESOLUTION);
+	return TWI_OK;
 }
 
 /*
-* If pressure averaging is enabled, make a function for that reason
+* Pressure filter, fed with one pressure value each time a pressure conversion finishes
+* The filter type is selected by PRESS_FILTER_TYPE and each new value costs the same time, no matter how many samples the filter holds
 */
-#if PRESS_AVERAGING_ENABLE
-int32_t BMP180_Averaging_Filter(void)
+#if PRESS_FILTER_TYPE == PRESS_FILTER_MOVING_AVG
+int32_t BMP180_Filter_Update(BMP180_Dev *dev, int32_t pressure)
 {
-	int32_t sum_UP = 0, sum_B5 = 0; //Variables to hold the sum for averaging
+	if (dev->filter_count < PRESS_FILTER_SAMPLES)
+		dev->filter_count++;
+	else
+		dev->filter_sum -= dev->filter_samples[dev->filter_index]; //Remove the oldest value from the sum
+	
+	dev->filter_samples[dev->filter_index] = pressure;
+	dev->filter_sum += pressure;
+	if (++dev->filter_index >= PRESS_FILTER_SAMPLES)
+		dev->filter_index = 0;
 	
-	for (uint8_t i = 0; i < PRESS_AVERAGING_SAMPLES; i++)
+	return (dev->filter_sum/dev->filter_count);
+}
+
+#elif PRESS_FILTER_TYPE == PRESS_FILTER_IIR
+int32_t BMP180_Filter_Update(BMP180_Dev *dev, int32_t pressure)
+{
+	if (dev->filter_count == 0) //Start from the first value instead of zero
 	{
-		sum_UP += BMP180_Read_Press_Raw(); //Sum of the raw pressure value read from the sensor register
-		BMP180_Get_Temp(); //Call the function in order to calculate B5
-		sum_B5 += _B5; //Sum the B5 parameter for averaging
+		dev->filter_sum = pressure << PRESS_FILTER_IIR_SHIFT;
+		dev->filter_count = 1;
 	}
-	_B5 = sum_B5/PRESS_AVERAGING_SAMPLES; //Find the average of B5 and save it at B5 global variable
-	return (sum_UP/PRESS_AVERAGING_SAMPLES); //Return the averaged raw pressure value
+	else
+		dev->filter_sum += pressure - (dev->filter_sum >> PRESS_FILTER_IIR_SHIFT); //Move by 1/(2^PRESS_FILTER_IIR_SHIFT) of the difference
+	
+	return (dev->filter_sum >> PRESS_FILTER_IIR_SHIFT);
+}
+
+#elif PRESS_FILTER_TYPE == PRESS_FILTER_MEDIAN
+int32_t BMP180_Filter_Update(BMP180_Dev *dev, int32_t pressure)
+{
+	uint8_t i = 0;
+	
+	if (dev->filter_count < PRESS_FILTER_SAMPLES)
+		i = dev->filter_count++;
+	else //Remove the oldest value from the sorted values, by moving the higher values one place down
+	{
+		while (dev->filter_sorted[i] != dev->filter_samples[dev->filter_index])
+			i++;
+		for (; i < PRESS_FILTER_SAMPLES - 1; i++)
+			dev->filter_sorted[i] = dev->filter_sorted[i + 1];
+	}
+	
+	//Insert the new value at its place, by moving the higher values one place up
+	for (; (i > 0) && (dev->filter_sorted[i - 1] > pressure); i--)
+		dev->filter_sorted[i] = dev->filter_sorted[i - 1];
+	dev->filter_sorted[i] = pressure;
+	
+	dev->filter_samples[dev->filter_index] = pressure;
+	if (++dev->filter_index >= PRESS_FILTER_SAMPLES)
+		dev->filter_index = 0;
+	
+	return (dev->filter_sorted[dev->filter_count/2]);
 }
 #endif
 
+/*
+* Check if the temperature must be read again before a pressure reading, when the auto update is enabled
+* The temperature is read once every BMP180_TEMP_UPDATE_RATE pressure readings, starting from the first one
+*/
+uint8_t BMP180_Temp_Due(BMP180_Dev *dev)
+{
+	if (dev->temp_countdown == 0)
+	{
+		dev->temp_countdown = BMP180_TEMP_UPDATE_RATE - 1;
+		return 1;
+	}
+	dev->temp_countdown--;
+	return 0;
+}
+
 /*
 * Initialize the needed parameters and read the calibration parameters from the sensor
+* Provide the device structure of the sensor and its 7-bit address, which is BMP180_ADDR for the BMP180 and the BMP085
+* With the EEPROM cache enabled, set the cache_slot of the device before calling this function, if there are more than one sensors
+* Returns TWI_OK, or the error of the bus if the sensor didn't respond, then call it again before the other functions
 */
-void BMP180_Init(void)
+uint8_t BMP180_Init(BMP180_Dev *dev, uint8_t address)
 {
+	dev->address = address;
+	dev->temp_countdown = 0;
+	dev->state = BMP180_IDLE;
+	dev->press_requested = 0;
+	dev->ready = 0;
+	dev->last_temp = 0;
+	dev->last_press = 0;
+	dev->error = TWI_OK;
+	#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE
+		dev->filter_count = 0; //Start the filter from the beginning
+		dev->filter_index = 0;
+		dev->filter_sum = 0;
+	#endif
+	#if TWI_ASYNC_ENABLE
+		dev->command_trans.status = TWI_TRANS_IDLE; //The descriptors are waited for before their first use, so they must not look pending
+		dev->read_trans.status = TWI_TRANS_IDLE;
+	#endif
+	
+
 	#if BMP180_TWI_INIT //If the automatic initialization of the I2C interface is enabled do the following
 		TWIInit(); //Initialize the I2C interface of the MCU
 		_delay_us(10); //Delay 10 micro seconds to give some time to the MCU for the I2C interface startup
 	#endif
 	
-	BMP180_Get_Calibration_Params(); //Get the calibration parameters of the sensor
-	BMP180_Get_Temp(); //Get a temperature measurement to initialize B5
+	if (BMP180_Get_Calibration_Params(dev)) //Get the calibration parameters of the sensor
+		return dev->error;
+	
+	#if !(BMP180_EEPROM_CACHE && BMP180_AUTOUPDATETEMP) //With auto update B5 is calculated before every pressure reading, so a fast start up can skip it
+		BMP180_Get_Temp(dev); //Get a temperature measurement to initialize B5
+	#endif
+	return dev->error;
 }
 
 /*
 * Function that returns the true temperature read from the sensor
 * The value returned is an integer with an accuracy of 0.1C, multiplied by 10, so if you want to obtain the decimal temperature divide by 10
+* If the bus fails, dev->error is set and the last good temperature is returned
 */
-int16_t BMP180_Get_Temp(void)
+int16_t BMP180_Get_Temp(BMP180_Dev *dev)
 {
-	//Variables for the following calculations
 	uint16_t UT = 0;
+	
+	dev->error = TWI_OK;
+	if (BMP180_Read_Temp_Raw(dev, &UT) == TWI_OK) //Get the raw temperature value from the sensor and calculate the true value
+		dev->last_temp = BMP180_Calc_Temp(dev, UT);
+	return (dev->last_temp);
+}
+
+/*
+* Calculate the true temperature from the raw temperature value and update B5 for the pressure calculation
+*/
+int16_t BMP180_Calc_Temp(BMP180_Dev *dev, uint16_t UT)
+{
+	//Variables for the following calculations
 	int32_t X1 = 0;
 	int32_t X2 = 0;
 	
 	//Calculate the true temperature value, according to the data sheet
-	UT = BMP180_Read_Temp_Raw(); //Get the raw temperature value from the sensor
-	X1 = ((((int32_t)UT - (int32_t)calibration_values[AC6]))*(int32_t)calibration_values[AC5]) >> 15; //Shifting right (n) times, is the same as dividing by (2^n)
-	X2 = ((int32_t)calibration_values[MC] << 11)/(X1 + (int32_t)calibration_values[MD]); //And shifting left (n) times, is the same as multiplying by (2^n)
-	_B5 = X1 + X2;
+	X1 = ((((int32_t)UT - (int32_t)dev->calibration_values[AC6]))*(int32_t)dev->calibration_values[AC5]) >> 15; //Shifting right (n) times, is the same as dividing by (2^n)
+	X2 = ((int32_t)dev->calibration_values[MC] << 11)/(X1 + (int32_t)dev->calibration_values[MD]); //And shifting left (n) times, is the same as multiplying by (2^n)
+	dev->B5 = X1 + X2;
+	BMP180_Update_Press_Terms(dev); //B5 has changed, so calculate again the temperature terms of the pressure
 	
-	return ((int16_t)((_B5 + 8) >> 4)); //Return the calculated true temperature value
+	return ((int16_t)((dev->B5 + 8) >> 4)); //Return the calculated true temperature value
 }
 
 /*
 * Function that returns the true pressure value read from the sensor
 * The value returned is an integer with an accuracy of 0.01Pa, multiplied by 100, so if you want to obtain the decimal pressure in hPa divide by 100
+* If the bus fails, dev->error is set and the last good pressure is returned
 */
-int32_t BMP180_Get_Pressure(void)
+int32_t BMP180_Get_Pressure(BMP180_Dev *dev)
 {
-	//Variables for the following calculations
-	int32_t B6 = 0, X1 = 0, X2 = 0, X3 = 0, B3 = 0, pressure = 0, UP = 0;
-	uint32_t B4 = 0, B7 = 0;
+	int32_t UP = 0;
 	
+	dev->error = TWI_OK;
 	#if BMP180_AUTOUPDATETEMP //If temperature auto update enabled...
-		BMP180_Get_Temp(); //Get the temperature first to calculate variable B5 needed for the pressure calculation
+		if (BMP180_Temp_Due(dev))
+		{
+			BMP180_Get_Temp(dev); //Get the temperature first to calculate variable B5 needed for the pressure calculation
+			if (dev->error)
+			{
+				dev->temp_countdown = 0; //B5 is old, so read the temperature again next time
+				return (dev->last_press);
+			}
+		}
 	#endif
 	
-	#if PRESS_AVERAGING_ENABLE //If averaging enabled...
-		UP = BMP180_Averaging_Filter(); //Get the averaged raw pressure value for further calculation
-	#else //If averaging is not enabled...
-		UP = BMP180_Read_Press_Raw(); //Just get the raw pressure value from the sensor one time
+	if (BMP180_Read_Press_Raw(dev, &UP)) //Get the raw pressure value from the sensor
+		return (dev->last_press);
+	
+	dev->last_press = BMP180_Calc_Pressure(dev, UP);
+	#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE //If a filter is selected, return the filtered value
+		dev->last_press = BMP180_Filter_Update(dev, dev->last_press);
 	#endif
+	return (dev->last_press);
+}
+
+/*
+* Calculate the terms of the pressure calculation that depend only on B5 and the calibration values
+* It must be called every time B5 changes, so the pressure calculation is left only with the terms of the raw pressure value
+*/
+void BMP180_Update_Press_Terms(BMP180_Dev *dev)
+{
+	//Variables for the following calculations
+	int32_t B6 = 0, X1 = 0, X2 = 0, X3 = 0;
+	
+	//Shifting left and right (n) times is the same as multiplying and dividing by (2^n) accordingly
+	B6 = dev->B5 - 4000;
+	X1 = (dev->calibration_values[B2]*(B6*B6) >> 12) >> 11;
+	X2 = (dev->calibration_values[AC2]*B6) >> 11;
+	X3 = X1 + X2;
+	dev->B3 = (((((int32_t)dev->calibration_values[AC1])*4 + X3) << PRESS_RESOLUTION) + 2) >> 2;
+	X1 = (dev->calibration_values[AC3]*B6) >> 13;
+	X2 = (dev->calibration_values[B1]*((B6*B6) >> 12)) >> 16;
+	X3 = ((X1 + X2) + 2) >> 2;
+	dev->B4 = (dev->ac4_reg*((X3 + 32768))) >> 15;
+}
+
+/*
+* Calculate the true pressure from the raw pressure value, using the B5 of the last temperature calculation
+*/
+int32_t BMP180_Calc_Pressure(BMP180_Dev *dev, int32_t UP)
+{
+	//Variables for the following calculations
+	int32_t X1 = 0, X2 = 0, pressure = 0;
+	uint32_t B7 = 0;
 	
 	/*
 	* Calculate the true pressure value, according to the data sheet
-	* Shifting left and right (n) times is the same as multiplying and dividing by (2^n) accordingly
+	* B3 and B4 depend only on the temperature, so they are already calculated by BMP180_Update_Press_Terms()
 	*/
-	B6 = _B5 - 4000;
-	X1 = (calibration_values[B2]*(B6*B6) >> 12) >> 11;
-	X2 = (calibration_values[AC2]*B6) >> 11;
-	X3 = X1 + X2;
-	B3 = (((((int32_t)calibration_values[AC1])*4 + X3) << PRESS_RESOLUTION) + 2) >> 2;
-	X1 = (calibration_values[AC3]*B6) >> 13;
-	X2 = (calibration_values[B1]*((B6*B6) >> 12)) >> 16;
-	X3 = ((X1 + X2) + 2) >> 2;
-	B4 = (_ac4_reg*((X3 + 32768))) >> 15;
-	B7 = ((uint32_t)UP - B3)*(50000 >> PRESS_RESOLUTION);
-	pressure = (B7 < 0x80000000) ? ((B7 << 1)/B4) : ((B7/B4) << 1);
+	B7 = ((uint32_t)UP - dev->B3)*(50000 >> PRESS_RESOLUTION);
+	pressure = (B7 < 0x80000000) ? ((B7 << 1)/dev->B4) : ((B7/dev->B4) << 1);
 	X1 = (pressure >> 8)*(pressure >> 8);
 	X1 = (X1*3038) >> 16;
 	X2 = (-7357*pressure) >> 16;
@@ -196,34 +448,295 @@ int32_t BMP180_Get_Pressure(void)
 	return (pressure);
 }
 
+/*
+* Start a temperature conversion at the sensor and return without waiting for it
+* Call BMP180_Poll() afterwards to read the value when the sensor has finished
+* Returns TWI_OK, or the error of the bus if the command was not sent
+*/
+uint8_t BMP180_StartTemp(BMP180_Dev *dev)
+{
+	dev->error = TWI_OK;
+	dev->press_requested = 0;
+	if (BMP180_Send_Command(dev, RAW_VALUE_READ_REGISTER, TEMP_READ_COMMAND))
+		return dev->error;
+	dev->state = BMP180_TEMP_CONV;
+	return TWI_OK;
+}
+
+/*
+* Start a pressure measurement at the sensor and return without waiting for it
+* If BMP180_AUTOUPDATETEMP is enabled and the temperature is due, a temperature conversion runs first and BMP180_Poll() starts the pressure conversion after it
+* Returns TWI_OK, or the error of the bus if the command was not sent
+*/
+uint8_t BMP180_StartPressure(BMP180_Dev *dev)
+{
+	#if BMP180_AUTOUPDATETEMP
+		if (BMP180_Temp_Due(dev))
+		{
+			if (BMP180_StartTemp(dev))
+			{
+				dev->temp_countdown = 0;
+				return dev->error;
+			}
+			dev->press_requested = 1;
+			return TWI_OK;
+		}
+	#endif
+	dev->error = TWI_OK;
+	if (BMP180_Send_Command(dev, RAW_VALUE_READ_REGISTER, PRESS_READ_COMMAND + (PRESS_RESOLUTION << 6)))
+		return dev->error;
+	dev->state = BMP180_PRESS_CONV;
+	return TWI_OK;
+}
+
+/*
+* End the running measurement after a failure of the bus, the error stays at dev->error
+*/
+uint8_t BMP180_Poll_Failed(BMP180_Dev *dev)
+{
+	dev->state = BMP180_IDLE;
+	dev->press_requested = 0;
+	dev->temp_countdown = 0; //The temperature of a failed pair may be missing, so read it again next time
+	return 1;
+}
+
+/*
+* Check the SCO bit of the sensor to see if the running conversion has finished and if so read the result and move to the next step
+* The function never waits for a conversion, so call it as often as you like, it returns 1 when new values are ready to be collected
+* It also returns 1 when the measurement has failed on the bus, then dev->error is set and BMP180_Collect() returns 0 with the previous values
+*/
+uint8_t BMP180_Poll(BMP180_Dev *dev)
+{
+	uint8_t bytes[3]; //Array to store the bytes read from the sensor registers
+	
+	if (dev->state == BMP180_IDLE) //Nothing is running
+		return (dev->ready || dev->error);
+	
+	if (BMP180_Wait_Command(dev) || BMP180_Read_Bytes(dev, RAW_VALUE_READ_REGISTER, bytes, 1) || BMP180_Wait_Read(dev)) //Read the control register to check the conversion status
+		return BMP180_Poll_Failed(dev);
+	if (bytes[0] & (1 << CONV_RUNNING_BIT)) //The sensor is still converting
+		return dev->ready;
+	
+	if (dev->state == BMP180_TEMP_CONV)
+	{
+		if (BMP180_Read_Bytes(dev, TEMP_READ_UNCL_MSB, bytes, 2) || BMP180_Wait_Read(dev))
+			return BMP180_Poll_Failed(dev);
+		dev->last_temp = BMP180_Calc_Temp(dev, ((uint16_t)bytes[0] << 8) | ((uint16_t)bytes[1]));
+		
+		if (dev->press_requested) //Continue with the pressure conversion, now that B5 is updated
+		{
+			dev->press_requested = 0;
+			if (BMP180_Send_Command(dev, RAW_VALUE_READ_REGISTER, PRESS_READ_COMMAND + (PRESS_RESOLUTION << 6)))
+				return BMP180_Poll_Failed(dev);
+			dev->state = BMP180_PRESS_CONV;
+			return dev->ready;
+		}
+	}
+	else
+	{
+		if (BMP180_Read_Bytes(dev, PRESS_READ_UNCL_MSB, bytes, 3) || BMP180_Wait_Read(dev))
+			return BMP180_Poll_Failed(dev);
+		dev->last_press = BMP180_Calc_Pressure(dev, (((int32_t)bytes[0] << 16) | ((int32_t)bytes[1] << 8) | ((int32_t)bytes[2])) >> (8 - PRESS_RESOLUTION));
+		#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE
+			dev->last_press = BMP180_Filter_Update(dev, dev->last_press);
+		#endif
+	}
+	
+	dev->state = BMP180_IDLE;
+	dev->ready = 1;
+	return dev->ready;
+}
+
+/*
+* Get the values of the last finished measurement
+* Returns 1 and clears the ready flag if there were new values since the last call, otherwise returns 0 and the previous values
+* Any of the pointers can be 0 if that value is not needed
+*/
+uint8_t BMP180_Collect(BMP180_Dev *dev, int16_t *temp, int32_t *pressure)
+{
+	uint8_t was_ready = dev->ready;
+	
+	if (temp)
+		*temp = dev->last_temp;
+	if (pressure)
+		*pressure = dev->last_press;
+	dev->ready = 0;
+	return was_ready;
+}
+
 /*
 * Get the temperature value at its correct decimal form
 */
-inline double BMP180_Get_Celcius_Temp(void)
+double BMP180_Get_Celcius_Temp(BMP180_Dev *dev)
 {
-	return ((double)BMP180_Get_Temp()/10.0);
+	return ((double)BMP180_Get_Temp(dev)/10.0);
 }
 
 /*
 * Get the pressure value at hPa
 */
-inline double BMP180_Get_hPa_Press(void)
+double BMP180_Get_hPa_Press(BMP180_Dev *dev)
 {
-	return ((double)BMP180_Get_Pressure()/100.0);
+	return ((double)BMP180_Get_Pressure(dev)/100.0);
 }
 
 /*
 * Get the altitude in meters, by providing the sea level pressure, which you may take from your local airport METAR
 */
-inline double BMP180_Absolute_Altitude(double sea_level_press)
+double BMP180_Absolute_Altitude(BMP180_Dev *dev, double sea_level_press)
 {
-	return (44330.0*(1.0 - pow((BMP180_Get_hPa_Press()/sea_level_press), (1.0/5.255)))); //Calculate the altitude according to the data sheet
+	return (44330.0*(1.0 - pow((BMP180_Get_hPa_Press(dev)/sea_level_press), (1.0/5.255)))); //Calculate the altitude according to the data sheet
 }
 
 /*
 * Get the sea level pressure in hPa, by providing the altitude in meters, which you may take from Google maps
 */
-inline double BMP180_Sea_Level_Press(double altitude)
+double BMP180_Sea_Level_Press(BMP180_Dev *dev, double altitude)
+{
+	return (BMP180_Get_hPa_Press(dev)*pow((1.0 - altitude/44330.0), -5.255)); //Calculate the sea level pressure according to the data sheet
+}
+
+/*
+* Fixed point altitude and sea level pressure calculations, without the math library
+* The values are kept as Q30 numbers, which means that the integer value is the real value multiplied by 2^30
+* The power (p/p0)^(1/5.255) is split as (2^-j)^(1/5.255) * m^(1/5.255), with m from 1 to 2, and m^(1/5.255) is taken from a table with linear interpolation
+*/
+const uint32_t altitude_power_table[129] PROGMEM = //m^(1/5.255) as Q30, for m = 1 + i/128
+{
+	1073741824UL, 1075333108UL, 1076914436UL, 1078485945UL, 1080047770UL, 1081600043UL,
+	1083142896UL, 1084676453UL, 1086200840UL, 1087716178UL, 1089222586UL, 1090720181UL,
+	1092209077UL, 1093689387UL, 1095161221UL, 1096624686UL, 1098079887UL, 1099526929UL,
+	1100965913UL, 1102396938UL, 1103820103UL, 1105235502UL, 1106643231UL, 1108043381UL,
+	1109436043UL, 1110821306UL, 1112199258UL, 1113569983UL, 1114933566UL, 1116290090UL,
+	1117639636UL, 1118982283UL, 1120318111UL, 1121647195UL, 1122969612UL, 1124285435UL,
+	1125594738UL, 1126897593UL, 1128194070UL, 1129484238UL, 1130768166UL, 1132045921UL,
+	1133317568UL, 1134583173UL, 1135842799UL, 1137096509UL, 1138344365UL, 1139586428UL,
+	1140822757UL, 1142053411UL, 1143278449UL, 1144497926UL, 1145711900UL, 1146920424UL,
+	1148123555UL, 1149321344UL, 1150513846UL, 1151701111UL, 1152883192UL, 1154060137UL,
+	1155231998UL, 1156398822UL, 1157560658UL, 1158717553UL, 1159869554UL, 1161016707UL,
+	1162159057UL, 1163296650UL, 1164429528UL, 1165557736UL, 1166681316UL, 1167800311UL,
+	1168914762UL, 1170024711UL, 1171130197UL, 1172231260UL, 1173327941UL, 1174420277UL,
+	1175508307UL, 1176592069UL, 1177671600UL, 1178746937UL, 1179818115UL, 1180885172UL,
+	1181948141UL, 1183007059UL, 1184061958UL, 1185112874UL, 1186159839UL, 1187202887UL,
+	1188242050UL, 1189277361UL, 1190308850UL, 1191336551UL, 1192360493UL, 1193380707UL,
+	1194397223UL, 1195410072UL, 1196419282UL, 1197424883UL, 1198426903UL, 1199425371UL,
+	1200420315UL, 1201411762UL, 1202399740UL, 1203384276UL, 1204365397UL, 1205343128UL,
+	1206317497UL, 1207288528UL, 1208256247UL, 1209220680UL, 1210181850UL, 1211139784UL,
+	1212094504UL, 1213046035UL, 1213994401UL, 1214939625UL, 1215881730UL, 1216820740UL,
+	1217756676UL, 1218689561UL, 1219619418UL, 1220546268UL, 1221470133UL, 1222391034UL,
+	1223308992UL, 1224224029UL, 1225136165UL
+};
+
+const uint32_t altitude_octave_power[5] PROGMEM = {1073741824UL, 941055809UL, 824766266UL, 722847028UL, 633522304UL}; //(2^-j)^(1/5.255) as Q30
+const uint32_t altitude_octave_inverse[5] PROGMEM = {1073741824UL, 1225136165UL, 1397876649UL, 1594973017UL, 1819859376UL}; //(2^j)^(1/5.255) as Q30
+
+/*
+* Multiply two numbers and divide the result by 2^30, using only 32-bit multiplications
+* The result must fit in 32 bits and it can be up to 3 units smaller than the exact one
+*/
+uint32_t BMP180_Mul_Q30(uint32_t a, uint32_t b)
+{
+	uint32_t ah = a >> 16, al = a & 0xFFFF, bh = b >> 16, bl = b & 0xFFFF;
+	
+	return (((ah*bh) << 2) + ((ah*bl) >> 14) + ((al*bh) >> 14) + ((al*bl) >> 30));
+}
+
+/*
+* Calculate num*2^shift/den with a bit by bit division, so no 64-bit numbers are needed
+* The den must be smaller than 2^31 and the result must fit in 32 bits
+*/
+uint32_t BMP180_Div_Shift(uint32_t num, uint32_t den, uint8_t shift)
+{
+	uint32_t remainder = 0, quotient = 0;
+	uint8_t bits = 32 + shift;
+	
+	while (bits && !(num & 0x80000000)) //The leading zeros of num don't change the result, so skip them
+	{
+		num <<= 1;
+		bits--;
+	}
+	for (; bits > 0; bits--)
+	{
+		remainder = (remainder << 1) | (num >> 31); //Bring down the next bit of num, which is zero after its last bit
+		num <<= 1;
+		quotient <<= 1;
+		if (remainder >= den)
+		{
+			remainder -= den;
+			quotient |= 1;
+		}
+	}
+	return (quotient);
+}
+
+/*
+* Calculate the altitude in centimeters from the pressure and the sea level pressure, both in Pascal
+* The pressure must be between 0.0625 and 2 times the sea level pressure
+* Compared to the floating point formula, the result is within 6.6cm, mostly the 5.2cm of the linear interpolation near m = 1, see ../Bench/Altitude.cpp for the error terms
+*/
+int32_t BMP180_Altitude_cm(int32_t pressure, int32_t sea_level_press)
 {
-	return (BMP180_Get_hPa_Press()*pow((1.0 - altitude/44330.0), -5.255)); //Calculate the sea level pressure according to the data sheet
+	uint32_t m = 0, power = 0, low = 0, high = 0;
+	uint8_t j = 0, i = 0;
+	
+	while ((j < 4) && (((uint32_t)pressure << j) < (uint32_t)sea_level_press)) //Find the power of two that brings the ratio between 1 and 2
+		j++;
+	m = BMP180_Div_Shift((uint32_t)pressure << j, sea_level_press, 24); //The ratio m as Q24
+	if (m < (1UL << 24)) //Out of the table range, keep it at its edge
+		m = 1UL << 24;
+	else if (m >= (2UL << 24))
+		m = (2UL << 24) - 1;
+	
+	//Interpolate between the two nearest table values
+	i = (m >> 17) - 128;
+	low = pgm_read_dword(&altitude_power_table[i]);
+	high = pgm_read_dword(&altitude_power_table[i + 1]);
+	power = low + BMP180_Mul_Q30(high - low, (m & 0x1FFFF) << 13);
+	power = BMP180_Mul_Q30(power, pgm_read_dword(&altitude_octave_power[j])); //Now it is (p/p0)^(1/5.255)
+	
+	//Altitude = 44330m * (1 - (p/p0)^(1/5.255)), taken 4 times larger and rounded, so the 3 units that BMP180_Mul_Q30() can lose are only 0.75cm
+	if (power <= (1UL << 30))
+		return ((int32_t)((BMP180_Mul_Q30(((1UL << 30) - power) << 2, 4433000UL) + 2) >> 2));
+	else //Lower than the sea level
+		return (-(int32_t)((BMP180_Mul_Q30((power - (1UL << 30)) << 2, 4433000UL) + 2) >> 2));
 }
+
+/*
+* Calculate the sea level pressure in Pascal from the pressure in Pascal and the altitude in centimeters
+* The table is used in reverse, to find the ratio p/p0 which gives (p/p0)^(1/5.255) = 1 - altitude/44330m
+* For altitudes from -1000m to 9000m and sea level pressures from 900hPa to 1100hPa the result is within 1.2Pa of the floating point formula
+* The altitude must be from -6000m to 18000m
+*/
+int32_t BMP180_Sea_Level_Pa(int32_t pressure, int32_t altitude_cm)
+{
+	uint32_t x = 0, low = 0, high = 0, ratio = 0, fraction = 0;
+	uint8_t j = 0, i = 0, first = 0, last = 128;
+	
+	//x = 1 - altitude/44330m as Q30, where 1015925925 is 2^52/4433000
+	x = BMP180_Mul_Q30((uint32_t)(altitude_cm < 0 ? -altitude_cm : altitude_cm) << 8, 1015925925UL);
+	x = (altitude_cm < 0) ? ((1UL << 30) + x) : ((1UL << 30) - x);
+	
+	while ((j < 4) && (x < pgm_read_dword(&altitude_octave_power[j]))) //Find the power of two of the ratio
+		j++;
+	x = BMP180_Mul_Q30(x, pgm_read_dword(&altitude_octave_inverse[j])); //Now it is m^(1/5.255), with m from 1 to 2
+	
+	//Find the table values around x, with a binary search
+	while (last - first > 1)
+	{
+		i = (first + last) >> 1;
+		if (pgm_read_dword(&altitude_power_table[i]) <= x)
+			first = i;
+		else
+			last = i;
+	}
+	low = pgm_read_dword(&altitude_power_table[first]);
+	high = pgm_read_dword(&altitude_power_table[first + 1]);
+	if (x < low) //Out of the table range, keep it at its edge
+		x = low;
+	fraction = BMP180_Div_Shift(x - low, high - low, 17);
+	if (fraction > 0x1FFFF)
+		fraction = 0x1FFFF;
+	
+	ratio = (((1UL << 24) + ((uint32_t)first << 17) + fraction) << 6) >> j; //The ratio p/p0 as Q30
+	return ((int32_t)((BMP180_Div_Shift(pressure, ratio, 31) + 1) >> 1)); //p0 = p/ratio, rounded
+}
\ No newline at end of file
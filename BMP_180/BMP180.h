@@ -19,13 +19,16 @@
 #define F_CPU 8000000UL //Change the clock speed according to yours
 #endif
 
-#include <avr/io.h> //A needed library in all projects, containing crucial things for the MCUs
-#include <util/delay.h> //Library that is used for the delays in functions
-#include <math.h> //Include the library for math operations
+#include "../HAL/HAL.h" //The registers, the delays and the flash and EEPROM access, of the MCU or of the host simulation
 #include "TWI.h" //The custom I2C communication library, change it if you use other and keep in mind to also change the functions accordingly
 
 //Calibration parameter registers
 #define FIRST_CALIB_REG_ADDR 0xAA //The memory address of the first register of the calibration values
+#define CALIB_BYTES_COUNT 22 //Number of bytes of all the calibration values, two for each value
+
+//Chip identification register
+#define CHIP_ID_REG 0xD0 //The register that holds the chip id
+#define BMP180_CHIP_ID 0x55 //The chip id that every BMP180 returns
 
 //Calibration parameter register index values for the calibration_values array
 #define AC1 0
@@ -46,37 +49,99 @@
 #define RAW_VALUE_READ_REGISTER 0xF4
 #define TEMP_READ_COMMAND 0x2E
 #define PRESS_READ_COMMAND 0x34 //Basic pressure read command
+#define CONV_RUNNING_BIT 5 //The SCO bit of the control register, which is set while a conversion is running
+
+//States of the non-blocking measurement
+#define BMP180_IDLE 0 //No conversion is running
+#define BMP180_TEMP_CONV 1 //A temperature conversion is running
+#define BMP180_PRESS_CONV 2 //A pressure conversion is running
 
 //Pressure resolution and condition parameters
 #define PRESS_RESOLUTION 3 //Set the pressure resolution with 3 the highest possible, from 0 to 3, incrementing by 1
-#define PRESS_AVERAGING_ENABLE 0 //Enable (1) or disable (0) the pressure averaging
-#define PRESS_AVERAGING_SAMPLES 50 //The number of pressure samples to be averaged, if averaging is enabled
+#define PRESS_FILTER_TYPE PRESS_FILTER_NONE //Select one of the pressure filter types below
+#define PRESS_FILTER_SAMPLES 8 //The number of pressure samples the moving average and the median filters use, up to 255
+#define PRESS_FILTER_IIR_SHIFT 3 //The exponential filter moves by 1/(2^n) of the difference with every new sample
+
+//Pressure filter types, each pressure reading feeds the filter with one sample
+#define PRESS_FILTER_NONE 0 //No filter
+#define PRESS_FILTER_MOVING_AVG 1 //Average of the last PRESS_FILTER_SAMPLES samples
+#define PRESS_FILTER_IIR 2 //Exponential filter
+#define PRESS_FILTER_MEDIAN 3 //Median of the last PRESS_FILTER_SAMPLES samples, which rejects the outliers
 
 //General functional parameters selection
 #define BMP180_TWI_INIT 0 //Set to (0) if you want to explicitly initialize the I2C interface, otherwise set to (1)
 #define BMP180_AUTOUPDATETEMP 1 //If you want a temperature auto update for the pressure calibration parameter set to (1)
+#define BMP180_TEMP_UPDATE_RATE 1 //With auto update, read the temperature once every this many pressure readings (1 means before every reading)
+#define BMP180_EEPROM_CACHE 0 //Set to (1) to keep a copy of the calibration values at the MCU EEPROM and skip reading them from the sensor at start up
+#define BMP180_EEPROM_CACHE_SLOTS 1 //Number of sensors that can keep a copy at the EEPROM, each one uses the slot set at its cache_slot
 
 //Device address and calibrated addresses
 #define BMP180_ADDR 0x77 //Address of the BMP sensor
-#define BMP180_READ 0xEF //Calibrated address of the sensor to include the read bit
-#define BMP180_WRITE 0xEE //Calibrated address of the sensor to include the write bit
+#define BMP180_TWI_FREQ 400000UL //SCL frequency of the sensor transactions, the BMP180 works in the 400kHz Fast-mode
 
-//Global variables and arrays used in functions and calculations
-int16_t calibration_values[11]; //Array to store the initial calibration values read from the memory
-int32_t _B5; //This variable is used both in temp and press calibration
-uint32_t _ac4_reg; //Save the AC4 register calibration value
+/*
+* Everything the library keeps for one sensor, so more than one sensors can be used at the same time
+* Declare one for each sensor and pass its address to all the functions
+*/
+typedef struct
+{
+	uint8_t address; //The 7-bit I2C address of the sensor
+	uint8_t cache_slot; //The EEPROM cache slot of the sensor, from 0 to BMP180_EEPROM_CACHE_SLOTS - 1
+	int16_t calibration_values[11]; //Array to store the initial calibration values read from the memory
+	uint32_t ac4_reg; //Save the AC4 register calibration value
+	int32_t B5; //This variable is used both in temp and press calibration
+	int32_t B3; //Temperature term of the pressure calculation, calculated again every time B5 changes
+	uint32_t B4; //Temperature term of the pressure calculation, calculated again every time B5 changes
+	uint8_t temp_countdown; //Pressure readings left until the next temperature update, when auto update is enabled
+	
+	//Variables of the non-blocking measurement
+	uint8_t state; //The conversion that is running at the sensor
+	uint8_t press_requested; //Set to (1) when a pressure conversion must follow the temperature conversion
+	uint8_t ready; //Set to (1) when new values are waiting to be collected
+	int16_t last_temp; //The last measured temperature multiplied by 10
+	int32_t last_press; //The last measured pressure in Pascal
+	uint8_t error; //TWI_OK, or the TWI_ERR_ value of the bus failure of the last function call, see TWI.h
+	
+	//Variables of the pressure filter
+	#if (PRESS_FILTER_TYPE == PRESS_FILTER_MOVING_AVG) || (PRESS_FILTER_TYPE == PRESS_FILTER_MEDIAN)
+		int32_t filter_samples[PRESS_FILTER_SAMPLES]; //Ring buffer of the last pressure values, in arrival order
+	#endif
+	#if PRESS_FILTER_TYPE == PRESS_FILTER_MEDIAN
+		int32_t filter_sorted[PRESS_FILTER_SAMPLES]; //The same values sorted from the lowest to the highest
+	#endif
+	#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE
+		uint8_t filter_index; //Place of the oldest value in the ring buffer
+		uint8_t filter_count; //Number of values in the ring buffer, until it is filled for the first time
+		int32_t filter_sum; //Sum of the values of the moving average, or the filtered value multiplied by 2^PRESS_FILTER_IIR_SHIFT of the exponential filter
+	#endif
+	
+	#if TWI_ASYNC_ENABLE
+		TWI_Transaction command_trans; //Queue descriptor of the last command sent, so the caller doesn't wait for the bus
+		uint8_t command_bytes[2]; //The command register and the command of the last command sent
+		TWI_Transaction read_trans; //Queue descriptor of the last register read
+		uint8_t read_register; //The register address of the last register read
+	#endif
+} BMP180_Dev;
 
 /*
 * extern functions are the ones for the end user
 * The functions that are used internally to make things simpler, are not included in the header file
 * If you want to use an internal function, just declare it here
 */
-extern void BMP180_Init(void); //BMP180 Initialization function
-extern int16_t BMP180_Get_Temp(void); //Get the temperature as an integer multiplied by 10
-extern double BMP180_Get_Celcius_Temp(void); //Get the decimal temperature in Celsius
-extern int32_t BMP180_Get_Pressure(void); //Get the pressure in Pascal
-extern double BMP180_Get_hPa_Press(void); //Get the hPa value of the pressure
-extern double BMP180_Absolute_Altitude(double sea_level_press); //Calculate the altitude in meters providing the sea level pressure in hPa
-extern double BMP180_Sea_Level_Press(double altitude); //Calculate the sea level pressure in hPa providing the altitude in meters
+extern uint8_t BMP180_Init(BMP180_Dev *dev, uint8_t address); //BMP180 Initialization function, provide the structure of the sensor and its address, returns TWI_OK or the error of the bus
+extern int16_t BMP180_Get_Temp(BMP180_Dev *dev); //Get the temperature as an integer multiplied by 10, or the last good one if the bus fails, see dev->error
+extern double BMP180_Get_Celcius_Temp(BMP180_Dev *dev); //Get the decimal temperature in Celsius
+extern int32_t BMP180_Get_Pressure(BMP180_Dev *dev); //Get the pressure in Pascal, or the last good one if the bus fails, see dev->error
+extern double BMP180_Get_hPa_Press(BMP180_Dev *dev); //Get the hPa value of the pressure
+extern double BMP180_Absolute_Altitude(BMP180_Dev *dev, double sea_level_press); //Calculate the altitude in meters providing the sea level pressure in hPa
+extern double BMP180_Sea_Level_Press(BMP180_Dev *dev, double altitude); //Calculate the sea level pressure in hPa providing the altitude in meters
+extern int32_t BMP180_Altitude_cm(int32_t pressure, int32_t sea_level_press); //Calculate the altitude in centimeters from the pressure and the sea level pressure in Pascal, without floating point
+extern int32_t BMP180_Sea_Level_Pa(int32_t pressure, int32_t altitude_cm); //Calculate the sea level pressure in Pascal from the pressure in Pascal and the altitude in centimeters, without floating point
+
+//Non-blocking measurement functions
+extern uint8_t BMP180_StartTemp(BMP180_Dev *dev); //Start a temperature conversion and return immediately, returns TWI_OK or the error of the bus
+extern uint8_t BMP180_StartPressure(BMP180_Dev *dev); //Start a pressure measurement, with a temperature conversion first if auto update is enabled, and return immediately, returns TWI_OK or the error of the bus
+extern uint8_t BMP180_Poll(BMP180_Dev *dev); //Move the running measurement forward without waiting, returns 1 when new values are ready or the measurement failed, see dev->error
+extern uint8_t BMP180_Collect(BMP180_Dev *dev, int16_t *temp, int32_t *pressure); //Get the last measured temperature multiplied by 10 and pressure in Pascal, returns 1 if they are new
 
 #endif
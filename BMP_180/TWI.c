@@ -1,55 +1,208 @@
 #include "TWI.h"
 
+#if TWI_TRACE_ENABLE
+#if (TWI_TRACE_SIZE & (TWI_TRACE_SIZE - 1)) || (TWI_TRACE_SIZE > 128)
+#error "TWI_TRACE_SIZE must be a power of two up to 128"
+#endif
+
+void TWI_Trace(uint8_t operation, uint8_t data);
+
+TWI_Trace_Event twi_trace[TWI_TRACE_SIZE]; //Ring buffer with the recorded events
+uint8_t twi_trace_first = 0; //Index of the oldest event
+uint8_t twi_trace_count = 0; //Number of events in the ring buffer
+
+#define TWI_TRACE(operation, data) TWI_Trace(operation, data)
+#else
+#define TWI_TRACE(operation, data) //Nothing to record
+#endif
+
+#if !TWI_FREQ_VALID(TWI_FREQ)
+#error "TWI_FREQ must be up to 400kHz and between F_CPU/(16 + 2*255*64) and F_CPU/16"
+#endif
+
+#define TWI_TIMEOUT_LOOPS ((F_CPU/1000000UL)*TWI_TIMEOUT_US/8) //Each pass of a wait loop takes about 8 cycles
+#if (TWI_TIMEOUT_LOOPS < 1) || (TWI_TIMEOUT_LOOPS > 65535)
+#error "TWI_TIMEOUT_US gives a wait loop count out of 1 to 65535"
+#endif
+
+//Internal function prototypes
+uint8_t TWI_Wait_Int(void);
+uint8_t TWI_Wait_Stop(void);
+uint8_t TWI_Error(uint8_t status);
+uint8_t TWI_End(uint8_t error);
+void TWI_Apply_Speed(uint16_t speed);
+
+uint16_t twi_speed; //The TWI_SPEED() that the bit rate registers have now
+
+#if TWI_ASYNC_ENABLE
+void TWI_Finish(uint8_t error);
+void TWI_Abort(void);
+void TWI_Start_Pending(void);
+
+TWI_Transaction *twi_queue[TWI_QUEUE_SIZE]; //Ring buffer with the transactions waiting for the bus, the first one is on the bus
+volatile uint8_t twi_queue_first = 0; //Index of the transaction that is on the bus
+volatile uint8_t twi_queue_count = 0; //Number of transactions in the queue
+uint8_t twi_byte_index; //Index of the byte being sent or received
+uint8_t twi_reading; //Set to (1) when the read part of the transaction is on the bus
+volatile uint8_t twi_progress = 0; //Changed by the interrupt at every step, so a wait can tell a stuck bus from a long queue
+volatile uint8_t twi_start_pending = 0; //Set when the first transaction of the queue must start after the last stop condition is sent, see TWI_Start_Pending()
+
+#define TWI_READ_FIRST(trans) (((trans)->write_count == 0) && ((trans)->read_count != 0)) //Only a read part, so the first address has the read bit, an empty transaction sends the write address alone
+#endif
+
 void TWIInit(void)
 {
-	//set SCL to 400kHz
-	TWSR = 0x00;
-	TWBR = ((F_CPU/TWI_FREQ) - 16)/2;
+	//set SCL to TWI_FREQ
+	twi_speed = TWI_SPEED(TWI_FREQ);
+	TWSR = TWI_PRESCALER_BITS(TWI_FREQ);
+	TWBR = TWI_TWBR(TWI_FREQ);
 	//enable TWI
 	TWCR = (1<<TWEN);
 }
 
-void TWIWrite(uint8_t u8data)
+/*
+* Write the bit rate registers, if the speed is not already set
+* The registers must not change during a stop condition, so the caller makes sure that it was sent
+*/
+void TWI_Apply_Speed(uint16_t speed)
+{
+	if (speed == TWI_SPEED_DEFAULT)
+		speed = TWI_SPEED(TWI_FREQ);
+	if (speed == twi_speed)
+		return;
+	twi_speed = speed;
+	TWSR = (speed >> 8) & 0x03;
+	TWBR = speed & 0xFF;
+}
+
+void TWISetSpeed(uint16_t speed)
 {
+	TWI_Wait_Stop(); //The last transaction ends at its old speed
+	TWI_Apply_Speed(speed);
+}
+
+/*
+* Wait for the running operation to end, at most TWI_TIMEOUT_US
+* If it doesn't end the bus is stuck, so it is recovered for the next operations
+*/
+uint8_t TWI_Wait_Int(void)
+{
+	uint16_t loops = TWI_TIMEOUT_LOOPS;
+	
+	while ((TWCR & (1<<TWINT)) == 0)
+	{
+		if (--loops == 0)
+		{
+			TWIRecover();
+			return TWI_ERR_TIMEOUT;
+		}
+	}
+	return TWI_OK;
+}
+
+/*
+* Wait for the last stop condition to be sent, at most TWI_TIMEOUT_US
+*/
+uint8_t TWI_Wait_Stop(void)
+{
+	uint16_t loops = TWI_TIMEOUT_LOOPS;
+	
+	while (TWCR & (1<<TWSTO))
+	{
+		if (--loops == 0)
+		{
+			TWIRecover();
+			return TWI_ERR_TIMEOUT;
+		}
+	}
+	return TWI_OK;
+}
+
+/*
+* The error of a failed operation from its status
+*/
+uint8_t TWI_Error(uint8_t status)
+{
+	if ((status == 0x20) || (status == 0x30) || (status == 0x48)) //Address or data byte not acknowledged
+		return TWI_ERR_NACK;
+	return TWI_ERR_BUS;
+}
+
+/*
+* End a transaction with a stop condition and return its result
+* After a timeout the recovery has already sent the stop condition
+*/
+uint8_t TWI_End(uint8_t error)
+{
+	if (error != TWI_ERR_TIMEOUT)
+		TWIStop();
+	return error;
+}
+
+uint8_t TWIWrite(uint8_t u8data)
+{
+	uint8_t status;
+	
 	TWDR = u8data;
 	TWCR = (1<<TWINT)|(1<<TWEN);
-	while ((TWCR & (1<<TWINT)) == 0);
+	if (TWI_Wait_Int())
+		return TWI_ERR_TIMEOUT;
+	TWI_TRACE(TWI_TRACE_WRITE, u8data);
+	status = TWIGetStatus();
+	if ((status == 0x18) || (status == 0x28) || (status == 0x40)) //Address with write or read bit, or data byte, acknowledged
+		return TWI_OK;
+	return TWI_Error(status);
 }
 
-void TWIWrite16(uint16_t u16data)
+uint8_t TWIWrite16(uint16_t u16data)
 {
-	TWDR = u16data & 0xF0; //Send the first byte
-	TWCR = (1<<TWINT)|(1<<TWEN);
-	while ((TWCR & (1<<TWINT)) == 0);
+	uint8_t error = TWIWrite(u16data >> 8); //Send the first byte
 	
-	TWDR = u16data & 0x0F; //Send the second byte
-	TWCR = (1<<TWINT)|(1<<TWEN);
-	while ((TWCR & (1<<TWINT)) == 0);
+	if (error)
+		return error;
+	return TWIWrite(u16data & 0xFF); //Send the second byte
 }
 
-void TWIStart(void)
+uint8_t TWIStart(void)
 {
+	uint8_t status;
+	
+	if (TWI_Wait_Stop()) //The TWI unit must finish the last stop condition first
+		return TWI_ERR_TIMEOUT;
 	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN);
-	while ((TWCR & (1<<TWINT)) == 0);
+	if (TWI_Wait_Int())
+		return TWI_ERR_TIMEOUT;
+	TWI_TRACE(TWI_TRACE_START, 0);
+	status = TWIGetStatus();
+	if ((status == 0x08) || (status == 0x10)) //Start or repeated start sent
+		return TWI_OK;
+	return TWI_ERR_START;
 }
 
 void TWIStop(void)
 {
 	TWCR = (1<<TWINT)|(1<<TWSTO)|(1<<TWEN);
+	TWI_TRACE(TWI_TRACE_STOP, 0);
 }
 
-uint8_t TWIReadACK(void)
+uint8_t TWIReadACK(uint8_t *data)
 {
 	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWEA);
-	while ((TWCR & (1<<TWINT)) == 0);
-	return TWDR;
+	if (TWI_Wait_Int())
+		return TWI_ERR_TIMEOUT;
+	*data = TWDR;
+	TWI_TRACE(TWI_TRACE_READ_ACK, *data);
+	return (TWIGetStatus() == 0x50) ? TWI_OK : TWI_ERR_BUS;
 }
 
-uint8_t TWIReadNACK(void)
+uint8_t TWIReadNACK(uint8_t *data)
 {
 	TWCR = (1<<TWINT)|(1<<TWEN)|(0<<TWEA);
-	while ((TWCR & (1<<TWINT)) == 0);
-	return TWDR;
+	if (TWI_Wait_Int())
+		return TWI_ERR_TIMEOUT;
+	*data = TWDR;
+	TWI_TRACE(TWI_TRACE_READ_NACK, *data);
+	return (TWIGetStatus() == 0x58) ? TWI_OK : TWI_ERR_BUS;
 }
 
 uint8_t TWIGetStatus(void)
@@ -57,4 +210,393 @@ uint8_t TWIGetStatus(void)
 	uint8_t status;
 	status = TWSR & 0xF8; //Mask status
 	return status;
-}
\ No newline at end of file
+}
+
+/*
+* Free the bus from a slave that holds SDA LOW, because it was reset or disturbed in the middle of a byte
+* The TWI unit is turned off and SCL is pulsed by hand until the slave releases SDA, at most 9 times, then a stop condition is sent
+* The PINS are only pulled LOW, as outputs, or released, as inputs, like the open drain outputs of the bus, so the bus needs its external pull-up resistors
+*/
+void TWIRecover(void)
+{
+	TWCR = 0; //The TWI unit releases the PINS
+	PIN_LOW(TWI_SCL_PIN);
+	PIN_LOW(TWI_SDA_PIN);
+	PIN_INPUT(TWI_SDA_PIN);
+	for (uint8_t i = 0; (i < 9) && !PIN_READ(TWI_SDA_PIN); i++)
+	{
+		PIN_OUTPUT(TWI_SCL_PIN); //SCL LOW
+		_delay_us(5);
+		PIN_INPUT(TWI_SCL_PIN); //SCL HIGH, the slave sends its next bit
+		_delay_us(5);
+	}
+	
+	//Stop condition, SDA rises while SCL is HIGH
+	PIN_OUTPUT(TWI_SCL_PIN);
+	_delay_us(5);
+	PIN_OUTPUT(TWI_SDA_PIN);
+	_delay_us(5);
+	PIN_INPUT(TWI_SCL_PIN);
+	_delay_us(5);
+	PIN_INPUT(TWI_SDA_PIN);
+	_delay_us(5);
+	TWCR = (1<<TWEN); //Back to the TWI unit
+	TWI_TRACE(TWI_TRACE_STOP, 1); //The failed transaction ends here in the trace too
+}
+
+/*
+* Read (count) consecutive registers of the slave, starting from the register (reg)
+* The register address is written and the read follows after a repeated start, so the bus is not released in between
+*/
+uint8_t TWIReadRegs(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count)
+{
+	uint8_t error = TWIStart();
+	
+	if (!error)
+		error = TWIWrite(address << 1); //Address with the write bit
+	if (!error)
+		error = TWIWrite(reg);
+	if (!error)
+		error = TWIStart(); //Repeated start
+	if (!error)
+		error = TWIWrite((address << 1) | 1); //Address with the read bit
+	for (uint8_t i = 0; (i < count) && !error; i++)
+	{
+		if (i == count - 1)
+			error = TWIReadNACK(&data[i]); //Don't acknowledge the last byte
+		else
+			error = TWIReadACK(&data[i]);
+	}
+	return TWI_End(error);
+}
+
+/*
+* Write (count) bytes to consecutive registers of the slave, starting from the register (reg)
+*/
+uint8_t TWIWriteRegs(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t count)
+{
+	uint8_t error = TWIStart();
+	
+	if (!error)
+		error = TWIWrite(address << 1); //Address with the write bit
+	if (!error)
+		error = TWIWrite(reg);
+	for (uint8_t i = 0; (i < count) && !error; i++)
+		error = TWIWrite(data[i]);
+	return TWI_End(error);
+}
+
+/*
+* Write bytes to a slave that has no registers, like an I/O expander
+*/
+uint8_t TWIWriteBytes(uint8_t address, const uint8_t *data, uint8_t count)
+{
+	uint8_t error = TWIStart();
+	
+	if (!error)
+		error = TWIWrite(address << 1); //Address with the write bit
+	for (uint8_t i = 0; (i < count) && !error; i++)
+		error = TWIWrite(data[i]);
+	return TWI_End(error);
+}
+
+#if TWI_TRACE_ENABLE
+/*
+* Add an event to the trace, with the time and the status of now, overwriting the oldest one if the trace is full
+*/
+void TWI_Trace(uint8_t operation, uint8_t data)
+{
+	uint8_t sreg = SREG; //The interrupt of the queue records events too
+	TWI_Trace_Event *event;
+	
+	cli();
+	if (twi_trace_count < TWI_TRACE_SIZE)
+		event = &twi_trace[(twi_trace_first + twi_trace_count++) & (TWI_TRACE_SIZE - 1)];
+	else //Full, so the oldest event gives its place
+	{
+		event = &twi_trace[twi_trace_first];
+		twi_trace_first = (twi_trace_first + 1) & (TWI_TRACE_SIZE - 1);
+	}
+	event->time = TWI_TRACE_TIME();
+	event->operation = operation;
+	event->status = TWIGetStatus();
+	event->data = data;
+	SREG = sreg;
+}
+
+uint8_t TWITraceGet(TWI_Trace_Event *event)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	if (twi_trace_count == 0)
+	{
+		SREG = sreg;
+		return 0;
+	}
+	*event = twi_trace[twi_trace_first];
+	twi_trace_first = (twi_trace_first + 1) & (TWI_TRACE_SIZE - 1);
+	twi_trace_count--;
+	SREG = sreg;
+	return 1;
+}
+
+/*
+* Each event is taken out and sent as 5 bytes, so the events recorded during the dump are sent too
+*/
+void TWITraceDump(void (*put_byte)(uint8_t data))
+{
+	TWI_Trace_Event event;
+	
+	while (TWITraceGet(&event))
+	{
+		put_byte(event.time & 0xFF);
+		put_byte(event.time >> 8);
+		put_byte(event.operation);
+		put_byte(event.status);
+		put_byte(event.data);
+	}
+}
+
+void TWITraceClear(void)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	twi_trace_first = 0;
+	twi_trace_count = 0;
+	SREG = sreg;
+}
+#endif
+
+#if TWI_ASYNC_ENABLE
+/*
+* Put a transaction in the queue and start the bus if it is idle
+* Returns 1 if the transaction was queued, or 0 if the queue is full and the transaction must be submitted later
+*/
+uint8_t TWISubmit(TWI_Transaction *trans)
+{
+	uint8_t sreg = SREG; //Save the interrupt state, so the function can be also called with interrupts disabled
+	cli();
+	
+	if (twi_queue_count >= TWI_QUEUE_SIZE) //No free place in the queue
+	{
+		SREG = sreg;
+		return 0;
+	}
+	
+	trans->status = TWI_TRANS_PENDING;
+	trans->error = TWI_OK;
+	twi_queue[(twi_queue_first + twi_queue_count) % TWI_QUEUE_SIZE] = trans; //Place it after the last queued transaction
+	twi_queue_count++;
+	
+	if (twi_queue_count == 1) //The bus was idle, so start this transaction now, or after the last stop condition if it is still being sent
+	{
+		twi_start_pending = 1;
+		TWI_Start_Pending();
+	}
+	SREG = sreg;
+	return 1;
+}
+
+/*
+* Start the first transaction of the queue, if it waits for the last stop condition and the stop has been sent
+* The bit rate can't change while the stop is sent, so the interrupt leaves the start of a transaction with another speed to this function, instead of waiting for the bus
+* It runs from TWISubmit(), TWIBusy() and TWIWait(), so with only callbacks the main loop must call TWIBusy()
+*/
+void TWI_Start_Pending(void)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	if (twi_start_pending && !(TWCR & (1<<TWSTO)))
+	{
+		twi_start_pending = 0;
+		TWI_Apply_Speed(twi_queue[twi_queue_first]->speed);
+		twi_reading = TWI_READ_FIRST(twi_queue[twi_queue_first]);
+		TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE);
+	}
+	SREG = sreg;
+}
+
+uint8_t TWIBusy(void)
+{
+	TWI_Start_Pending();
+	return (twi_queue_count != 0);
+}
+
+/*
+* The wait has no fixed length, because the transaction may be behind others in the queue
+* Instead the bus must move at least once every TWI_TIMEOUT_US, else the queue is aborted and the bus is recovered
+*/
+uint8_t TWIWait(TWI_Transaction *trans)
+{
+	uint8_t progress = twi_progress;
+	uint16_t loops = TWI_TIMEOUT_LOOPS;
+	
+	while (trans->status == TWI_TRANS_PENDING) //The interrupt changes the status when the transaction ends
+	{
+		TWI_Start_Pending();
+		if (twi_progress != progress) //The bus moved, so start counting again
+		{
+			progress = twi_progress;
+			loops = TWI_TIMEOUT_LOOPS;
+		}
+		else if (--loops == 0)
+			TWI_Abort();
+		HAL_Idle();
+	}
+	return trans->error;
+}
+
+void TWIWaitFree(void)
+{
+	while (twi_queue_count >= TWI_QUEUE_SIZE) //The first transaction leaves the queue when it ends or when the wait aborts a stuck bus
+		TWIWait(twi_queue[twi_queue_first]);
+}
+
+/*
+* End all the queued transactions with TWI_ERR_TIMEOUT and recover the bus
+*/
+void TWI_Abort(void)
+{
+	uint8_t sreg = SREG;
+	TWI_Transaction *trans;
+	
+	cli();
+	TWIRecover();
+	twi_start_pending = 0;
+	while (twi_queue_count)
+	{
+		trans = twi_queue[twi_queue_first];
+		twi_queue_first = (twi_queue_first + 1) % TWI_QUEUE_SIZE;
+		twi_queue_count--;
+		trans->error = TWI_ERR_TIMEOUT;
+		trans->status = TWI_TRANS_ERROR;
+		if (trans->callback)
+			trans->callback(trans);
+	}
+	SREG = sreg;
+}
+
+/*
+* End the transaction that is on the bus, with TWI_OK or the error of its failure, and start the next one if there is any
+* It is called only from the interrupt
+*/
+void TWI_Finish(uint8_t error)
+{
+	TWI_Transaction *trans = twi_queue[twi_queue_first];
+	
+	TWI_TRACE(TWI_TRACE_STOP, 0);
+	twi_queue_first = (twi_queue_first + 1) % TWI_QUEUE_SIZE; //Remove it from the queue
+	twi_queue_count--;
+	
+	if (twi_queue_count) //Send a stop followed by a start for the next transaction
+	{
+		TWI_Transaction *next = twi_queue[twi_queue_first];
+		
+		if ((next->speed ? next->speed : TWI_SPEED(TWI_FREQ)) == twi_speed) //The same speed, so the stop and the start go together
+		{
+			twi_reading = TWI_READ_FIRST(next);
+			TWCR = (1<<TWINT)|(1<<TWSTO)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE);
+		}
+		else //The stop condition is sent at the old speed, the next transaction starts at its own from TWI_Start_Pending()
+		{
+			TWCR = (1<<TWINT)|(1<<TWSTO)|(1<<TWEN);
+			twi_start_pending = 1;
+		}
+	}
+	else //Nothing else to do, so just release the bus
+		TWCR = (1<<TWINT)|(1<<TWSTO)|(1<<TWEN);
+	
+	trans->error = error;
+	trans->status = error ? TWI_TRANS_ERROR : TWI_TRANS_DONE;
+	if (trans->callback) //Let the owner know that the transaction has ended
+		trans->callback(trans);
+}
+
+/*
+* The state machine of the transactions, it moves one step each time the TWI hardware finishes a bus operation
+*/
+ISR(TWI_vect)
+{
+	TWI_Transaction *trans = twi_queue[twi_queue_first];
+	
+	twi_progress++;
+#if TWI_TRACE_ENABLE //Record the operation that has just finished, which is known from its status
+	switch (TWSR & 0xF8)
+	{
+		case 0x08:
+		case 0x10:
+			TWI_Trace(TWI_TRACE_START, 0);
+			break;
+		case 0x50:
+			TWI_Trace(TWI_TRACE_READ_ACK, TWDR);
+			break;
+		case 0x58:
+			TWI_Trace(TWI_TRACE_READ_NACK, TWDR);
+			break;
+		default: //An address or data byte, sent with or without acknowledgment
+			TWI_Trace(TWI_TRACE_WRITE, TWDR);
+			break;
+	}
+#endif
+	
+	switch (TWSR & 0xF8)
+	{
+		case 0x08: //Start condition sent
+		case 0x10: //Repeated start condition sent
+			twi_byte_index = 0;
+			TWDR = (trans->address << 1) | twi_reading; //Send the address with the read/write bit
+			TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE);
+			break;
+		
+		case 0x18: //Address with write bit sent and acknowledged
+		case 0x28: //Data byte sent and acknowledged
+			if (twi_byte_index < trans->write_count) //Send the next byte
+			{
+				TWDR = trans->write_data[twi_byte_index++];
+				TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE);
+			}
+			else if (trans->read_count) //Everything is sent, so continue with the read part after a repeated start
+			{
+				twi_reading = 1;
+				TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE);
+			}
+			else
+				TWI_Finish(TWI_OK);
+			break;
+		
+		case 0x40: //Address with read bit sent and acknowledged
+			if (trans->read_count > 1) //Acknowledge the received byte if more bytes are expected
+				TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE)|(1<<TWEA);
+			else
+				TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE);
+			break;
+		
+		case 0x50: //Data byte received and acknowledged
+			if (twi_byte_index < trans->read_count)
+				trans->read_data[twi_byte_index++] = TWDR;
+			if (twi_byte_index < trans->read_count - 1)
+				TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE)|(1<<TWEA);
+			else //Don't acknowledge the last byte
+				TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWIE);
+			break;
+		
+		case 0x58: //Last data byte received and not acknowledged
+			if (twi_byte_index < trans->read_count)
+				trans->read_data[twi_byte_index] = TWDR;
+			TWI_Finish(TWI_OK);
+			break;
+		
+		case 0x38: //Arbitration lost, try the whole transaction again when the bus is free
+			twi_reading = TWI_READ_FIRST(trans);
+			TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN)|(1<<TWIE);
+			break;
+		
+		default: //The slave did not acknowledge (0x20, 0x30, 0x48) or a bus error happened
+			TWI_Finish(TWI_Error(TWSR & 0xF8));
+			break;
+	}
+}
+#endif
\ No newline at end of file
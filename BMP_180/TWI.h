@@ -1,4 +1,3 @@
-
 #ifndef TWI_H_
 #define TWI_H_
 
@@ -6,18 +5,125 @@
 #define F_CPU 8000000UL
 #endif
 
-#include <avr/io.h>
-#include <util/delay.h>
+#include "../HAL/HAL.h"
+#include "../Pins/Pins.h"
+
+#define TWI_FREQ 200000UL //Set the clock communication frequency to 200kHz, the devices can have their own speed, see TWI_SPEED()
+
+/*
+* Bit rate of the TWI unit, SCL = F_CPU/(16 + 2*TWBR*prescaler), calculated by the preprocessor
+* The smallest prescaler that lets TWBR fit in 8 bits is taken and TWBR is rounded up, so SCL is never faster than asked
+* TWI_FREQ_VALID(freq) is (1) if the frequency is up to the 400kHz of the Fast-mode and the bit rate can make it, use it in #if to fail the build
+*/
+#define TWI_TWBR_FOR(freq, prescaler) ((F_CPU - 16*(freq) + 2UL*(prescaler)*(freq) - 1)/(2UL*(prescaler)*(freq)))
+#define TWI_PRESCALER_BITS(freq) ((TWI_TWBR_FOR(freq, 1) <= 255) ? 0 : (TWI_TWBR_FOR(freq, 4) <= 255) ? 1 : (TWI_TWBR_FOR(freq, 16) <= 255) ? 2 : 3) //The TWPS bits of TWSR
+#define TWI_PRESCALER(freq) (1UL << (2*TWI_PRESCALER_BITS(freq))) //1, 4, 16 or 64
+#define TWI_TWBR(freq) TWI_TWBR_FOR(freq, TWI_PRESCALER(freq))
+#define TWI_ACHIEVED_FREQ(freq) (F_CPU/(16 + 2*TWI_TWBR(freq)*TWI_PRESCALER(freq))) //The SCL frequency that the bus really gets
+#define TWI_FREQ_VALID(freq) (((freq) > 0) && ((freq) <= 400000UL) && (F_CPU >= 16*(freq)) && (TWI_TWBR_FOR(freq, 64) <= 255))
+
+/*
+* The speed of a device, TWBR with the prescaler bits above it, given to TWISetSpeed() or to the speed of a queued transaction
+* It is switched between the transactions, so a slow device and a fast one can share the bus, each at its own rate
+*/
+#define TWI_SPEED(freq) ((uint16_t)(0x8000 | (TWI_PRESCALER_BITS(freq) << 8) | TWI_TWBR(freq)))
+#define TWI_SPEED_DEFAULT 0 //The TWI_FREQ speed set by TWIInit()
+
+//Error handling
+#define TWI_TIMEOUT_US 1000 //Wait for one bus operation, after it the operation fails with TWI_ERR_TIMEOUT and the bus is recovered
+#define TWI_SCL_PIN C, 0 //The TWI PINS, driven by hand for the bus recovery, PC0 and PC1 on the ATmega644p
+#define TWI_SDA_PIN C, 1
+
+//Results of the blocking functions and of TWIWait()
+#define TWI_OK 0 //The operation finished with the expected status
+#define TWI_ERR_TIMEOUT 1 //The operation didn't finish in TWI_TIMEOUT_US, so the bus was recovered with TWIRecover()
+#define TWI_ERR_START 2 //The start condition was not sent
+#define TWI_ERR_NACK 3 //The slave did not acknowledge its address or a data byte
+#define TWI_ERR_BUS 4 //Bus error or lost arbitration
+
+//Interrupt driven transaction queue parameters
+#define TWI_ASYNC_ENABLE 0 //Set to (1) to run the transactions from the TWI interrupt through a queue, or (0) to use only the blocking functions
+#define TWI_QUEUE_SIZE 4 //Number of transactions that can wait in the queue at the same time
+
+//Status values of a queued transaction
+#define TWI_TRANS_IDLE 0 //The transaction was never submitted
+#define TWI_TRANS_PENDING 1 //The transaction is waiting in the queue or is on the bus right now
+#define TWI_TRANS_DONE 2 //The transaction finished successfully
+#define TWI_TRANS_ERROR 3 //The slave did not acknowledge or a bus error happened
 
-#define TWI_FREQ 200000UL //Set the clock communication frequency to 200kHz
+//Bus trace parameters
+#define TWI_TRACE_ENABLE 0 //Set to (1) to record every bus operation with its time and status in a RAM ring buffer, read it out with TWITraceDump()
+#define TWI_TRACE_SIZE 64 //Number of events the ring buffer holds, a power of two up to 128, the oldest events are overwritten when it is full
+#define TWI_TRACE_TIME() TCNT1 //The 16-bit time of the events, Timer1 by default, which must be running, or give a function of the application, the DHT22 library clocks Timer1 with its own prescaler while it reads
+
+//Bus operations of the trace events
+#define TWI_TRACE_START 0 //Start or repeated start condition
+#define TWI_TRACE_WRITE 1 //Address or data byte sent
+#define TWI_TRACE_READ_ACK 2 //Data byte received and acknowledged
+#define TWI_TRACE_READ_NACK 3 //Last data byte received and not acknowledged
+#define TWI_TRACE_STOP 4 //Stop condition, the data is (1) if it was sent by TWIRecover() after a timeout
+
+#if TWI_TRACE_ENABLE
+/*
+* One event of the trace, recorded when the operation has finished on the bus
+* TWITraceDump() sends it as 5 bytes: time LSB, time MSB, operation, status, data
+*/
+typedef struct
+{
+	uint16_t time; //TWI_TRACE_TIME() at the end of the operation
+	uint8_t operation; //One of the TWI_TRACE_ values above
+	uint8_t status; //TWIGetStatus() after the operation
+	uint8_t data; //The byte sent or received, zero for the start and stop conditions
+} TWI_Trace_Event;
+
+extern uint8_t TWITraceGet(TWI_Trace_Event *event); //Take the oldest event out of the trace, returns 0 if the trace is empty
+extern void TWITraceDump(void (*put_byte)(uint8_t data)); //Send all the events, oldest first, through the given function, for example to a UART, and empty the trace
+extern void TWITraceClear(void); //Remove all the events
+#endif
+
+#if TWI_ASYNC_ENABLE
+/*
+* Descriptor of a queued transaction
+* The write part is sent first and if there are bytes to be read, they are received after a repeated start condition
+* With no bytes to write and none to read only the address is sent, with the write bit, to see if the slave acknowledges it
+* The descriptor and the buffers belong to the caller and must stay valid until the status is no longer TWI_TRANS_PENDING
+*/
+typedef struct TWI_Transaction TWI_Transaction;
+struct TWI_Transaction
+{
+	uint8_t address; //The 7-bit address of the slave device, without the read/write bit
+	const uint8_t *write_data; //The bytes to be sent to the slave
+	uint8_t write_count; //Number of bytes to be sent, can be zero
+	uint8_t *read_data; //Buffer for the bytes received from the slave
+	uint8_t read_count; //Number of bytes to be received, can be zero
+	void (*callback)(TWI_Transaction *trans); //Called from the interrupt when the transaction ends, set to 0 if not needed
+	volatile uint8_t status; //One of the TWI_TRANS_ values above
+	uint8_t error; //TWI_OK, or the TWI_ERR_ value of the failure when the status is TWI_TRANS_ERROR
+	uint16_t speed; //TWI_SPEED() of the slave, or TWI_SPEED_DEFAULT
+};
+
+extern uint8_t TWISubmit(TWI_Transaction *trans); //Put a transaction in the queue and return immediately, returns 0 if the queue is full
+extern uint8_t TWIBusy(void); //Returns 1 while there are queued transactions
+extern uint8_t TWIWait(TWI_Transaction *trans); //Wait until the given transaction is finished, returns its error, a bus that stops moving for TWI_TIMEOUT_US is recovered
+extern void TWIWaitFree(void); //Wait until the queue has a free place, for a TWISubmit() that returned 0
+#endif
 
-extern void TWIInit(void); //Initialize the I2C interface
-extern void TWIStart(void); //Send a start signal
+/*
+* The blocking functions return TWI_OK or one of the TWI_ERR_ values
+* Each one waits at most TWI_TIMEOUT_US for the bus and the transaction functions stop at the first error, so a stuck bus or a missing slave can't hang the program
+*/
+extern void TWIInit(void); //Initialize the I2C interface at TWI_FREQ
+extern void TWISetSpeed(uint16_t speed); //Set the TWI_SPEED() of the next transactions of the blocking functions, after the last stop condition is sent
+extern uint8_t TWIStart(void); //Send a start signal
 extern void TWIStop(void); //Send a stop signal
-extern void TWIWrite(uint8_t u8data); //Send 8 bits of data
-extern void TWIWrite16(uint16_t u16data); //Send 16 bits of data
-extern uint8_t TWIReadACK(void); //Check if you received the acknowledgment from the other device
-extern uint8_t TWIReadNACK(void); //Expect no acknowledgment
+extern uint8_t TWIWrite(uint8_t u8data); //Send 8 bits of data, an address or a data byte, and check the acknowledgment
+extern uint8_t TWIWrite16(uint16_t u16data); //Send 16 bits of data, MSB first
+extern uint8_t TWIReadACK(uint8_t *data); //Receive a byte and acknowledge it, because more bytes are expected
+extern uint8_t TWIReadNACK(uint8_t *data); //Receive the last byte, without acknowledgment
 extern uint8_t TWIGetStatus(void); //Get the I2C status (Read the bits)
+extern void TWIRecover(void); //Free a bus held by a slave, with up to 9 SCL pulses and a stop condition, called by the functions after a timeout
+extern uint8_t TWIReadRegs(uint8_t address, uint8_t reg, uint8_t *data, uint8_t count); //Read consecutive registers of a slave in one transaction, using a repeated start
+extern uint8_t TWIWriteRegs(uint8_t address, uint8_t reg, const uint8_t *data, uint8_t count); //Write consecutive registers of a slave in one transaction
+extern uint8_t TWIWriteBytes(uint8_t address, const uint8_t *data, uint8_t count); //Write bytes to a slave without a register address, in one transaction
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <math.h>
+#include "../BMP_180/BMP180.h"
+
+/*
+* Accuracy test of the fixed point altitude functions of BMP180.c against the floating point formulas of the data sheet
+* The bounds are the ones given in ../BMP_180/README.md, the program prints the largest error of each sweep and returns 1 if a bound is exceeded
+*/
+
+/*
+* The bound of BMP180_Altitude_cm() is the sum of its error terms, the ones of (p/p0)^(1/5.255) multiplied by the 4433000cm of the formula
+* The linear interpolation of f(m) = m^a, a = 1/5.255, between table values h = 1/128 apart is off by at most h^2/8 * max|f''(m)|, with max|f''(m)| = a*(1 - a) at m = 1
+* The ratio m is truncated to Q24, which moves f(m) by at most max|f'(m)| * 2^-24 = a * 2^-24
+* The table and octave values are rounded to Q30 and the interpolation and octave products lose up to 3 units each, less than 8 units of 2^-30 together
+* The octave factor is at most 1, so it doesn't make these terms larger, and the final product with its rounding is at most 1.25cm off
+* It adds up to 6.54cm, for any pressure from 0.0625 to 2 times the sea level pressure
+*/
+#define ALTITUDE_EXPONENT (1.0/5.255)
+#define ALTITUDE_BOUND_CM (4433000.0*(ALTITUDE_EXPONENT*(1.0 - ALTITUDE_EXPONENT)/(8.0*128.0*128.0) + ALTITUDE_EXPONENT/16777216.0 + 8.0/1073741824.0) + 1.25)
+
+#define SEA_LEVEL_BOUND_PA 1.2 //BMP180_Sea_Level_Pa(), for altitudes from -1000m to 9000m and sea level pressures from 900hPa to 1100hPa
+
+/*
+* The altitude in centimeters of the data sheet formula, like BMP180_Absolute_Altitude()
+*/
+double Altitude_Reference(int32_t pressure, int32_t sea_level_press)
+{
+	return (4433000.0*(1.0 - pow((double)pressure/(double)sea_level_press, ALTITUDE_EXPONENT)));
+}
+
+/*
+* Print the result of a sweep and return 1 if its largest error is over the bound
+*/
+uint8_t Altitude_Report(const char *name, double max_error, double bound, long at_pressure, long at_second)
+{
+	uint8_t failed = (max_error > bound);
+
+	printf("%s,%.4f,%.2f,%ld,%ld,%s\n", name, max_error, bound, at_pressure, at_second, failed ? "fail" : "ok");
+	return failed;
+}
+
+int main(void)
+{
+	double error = 0, max_error = 0;
+	long at_pressure = 0, at_second = 0;
+	uint8_t failed = 0;
+
+	printf("sweep,max_error,bound,pressure,second,result\n");
+
+	//The altitude, every 10Pa from 300hPa to 1100hPa, at every 1hPa of the sea level pressure from 950hPa to 1050hPa
+	for (int32_t sea_level_press = 95000; sea_level_press <= 105000; sea_level_press += 100)
+		for (int32_t pressure = 30000; pressure <= 110000; pressure += 10)
+		{
+			error = fabs(BMP180_Altitude_cm(pressure, sea_level_press) - Altitude_Reference(pressure, sea_level_press));
+			if (error > max_error)
+			{
+				max_error = error;
+				at_pressure = pressure;
+				at_second = sea_level_press;
+			}
+		}
+	failed |= Altitude_Report("altitude_cm", max_error, ALTITUDE_BOUND_CM, at_pressure, at_second);
+
+	//The sea level pressure, every 1m from -1000m to 9000m, at every 5hPa of the sea level pressure from 900hPa to 1100hPa
+	max_error = 0;
+	for (int32_t sea_level_press = 90000; sea_level_press <= 110000; sea_level_press += 500)
+		for (int32_t altitude_cm = -100000; altitude_cm <= 900000; altitude_cm += 100)
+		{
+			double factor = pow(1.0 - altitude_cm/4433000.0, 5.255);
+			int32_t pressure = (int32_t)lround(sea_level_press*factor); //The pressure the sensor gives at that altitude
+
+			error = fabs(BMP180_Sea_Level_Pa(pressure, altitude_cm) - pressure/factor);
+			if (error > max_error)
+			{
+				max_error = error;
+				at_pressure = pressure;
+				at_second = altitude_cm;
+			}
+		}
+	failed |= Altitude_Report("sea_level_pa", max_error, SEA_LEVEL_BOUND_PA, at_pressure, at_second);
+
+	//The altitude at the low end of the range, every 1Pa from 0.0625 to 0.3 of a 1013.25hPa sea level pressure, with the same bound
+	max_error = 0;
+	for (int32_t pressure = 6333; pressure <= 30397; pressure++)
+	{
+		error = fabs(BMP180_Altitude_cm(pressure, 101325) - Altitude_Reference(pressure, 101325));
+		if (error > max_error)
+		{
+			max_error = error;
+			at_pressure = pressure;
+			at_second = 101325;
+		}
+	}
+	failed |= Altitude_Report("altitude_cm_low", max_error, ALTITUDE_BOUND_CM, at_pressure, at_second);
+
+	return failed;
+}
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include "../HAL/Host/Models.h"
+#include "../LCD/LCD.h"
+#include "../DHT_22/DHT.h"
+#include "../BMP_180/BMP180.h"
+
+/*
+* Benchmark of the libraries on the host backend of the HAL
+* Each workload runs once and its line shows the simulated time and the bus and PIN activity it caused, as CSV
+* The ok column is (1) if the result is correct and no device saw a timing violation
+*/
+
+extern uint8_t BMP180_Get_Calibration_Params(BMP180_Dev *dev); //Internal function of the BMP180 library, declared here to time the calibration load alone
+
+#define BENCH_NO_DEVICE_ADDR 0x50 //A TWI address without a device
+#define BENCH_BMP180_ADDR2 0x76 //The second sensor, the other address a BMP180 module can have
+#define BENCH_DHT2_PIN C, 3 //The second DHT22 of DHT_Read_Multi(), on the DHT_PORT next to the first one
+
+Host_HD44780 bench_lcd(LCD_COLS, LCD_ROWS);
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+Host_PCF8574 bench_pcf(&bench_lcd, LCD_PCF8574_ADDR);
+#endif
+Host_DHT22 bench_dht;
+#if DHT_MULTI_ENABLE
+Host_DHT22 bench_dht2;
+#endif
+Host_BMP180 bench_bmp(BMP180_ADDR);
+Host_BMP180 bench_bmp2(BENCH_BMP180_ADDR2); //The same calibration, so it can share the EEPROM cache slot, but another temperature
+BMP180_Dev bench_dev, bench_dev2;
+char bench_text[LCD_ROWS][LCD_COLS + 1]; //The text that the LCD should show
+
+/*
+* Write a text at a position, through the copy of the screen if it is enabled
+*/
+void Bench_LCD_Write(uint8_t x_position, uint8_t y_position, char *text)
+{
+#if LCD_SHADOW_ENABLE
+	LCD_Buf_SetCursor(x_position, y_position);
+	LCD_Buf_WriteStr(text);
+#else
+	LCD_SetCursor(x_position, y_position);
+	LCD_WriteStr(text);
+#endif
+}
+
+/*
+* Send what was written and wait until the LCD has it, then compare the LCD with the expected text
+*/
+uint8_t Bench_LCD_Done(void)
+{
+	char row[LCD_COLS + 1];
+
+#if LCD_SHADOW_ENABLE
+	LCD_Flush();
+#endif
+#if LCD_QUEUE_ENABLE
+	LCD_Sync();
+#endif
+	for (uint8_t i = 0; i < LCD_ROWS; i++)
+	{
+		bench_lcd.Row(i, row);
+		if (strcmp(row, bench_text[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+* Workloads
+*/
+uint8_t Bench_LCD_Full_Refresh(void)
+{
+	for (uint8_t i = 0; i < LCD_ROWS; i++)
+	{
+		for (uint8_t j = 0; j < LCD_COLS; j++)
+			bench_text[i][j] = 'A' + (i*LCD_COLS + j) % 26;
+		bench_text[i][LCD_COLS] = '\0';
+		Bench_LCD_Write(0, i + 1, bench_text[i]);
+	}
+	return Bench_LCD_Done();
+}
+
+uint8_t Bench_LCD_Digit_Update(void)
+{
+	char digit[2] = "7";
+
+	bench_text[LCD_ROWS - 1][LCD_COLS - 1] = digit[0];
+	Bench_LCD_Write(LCD_COLS - 1, LCD_ROWS, digit);
+	return Bench_LCD_Done();
+}
+
+uint8_t Bench_BMP180_Calibration(void)
+{
+	BMP180_Get_Calibration_Params(&bench_dev);
+	return (bench_dev.calibration_values[AC1] == 408);
+}
+
+uint8_t Bench_BMP180_Cycle(void)
+{
+	int16_t temp = BMP180_Get_Temp(&bench_dev);
+	int32_t pressure = BMP180_Get_Pressure(&bench_dev);
+
+	return ((temp == 150) && (pressure > 69960) && (pressure < 69968)); //15.0C and 69964Pa of the data sheet example
+}
+
+/*
+* Two sensors measure at the same time with the non-blocking functions, their transactions and conversions interleave on the bus
+* Each one must give the values it gives when it is read alone
+*/
+uint8_t Bench_BMP180_Two_Sensors(void)
+{
+	int16_t temp = 0, temp2 = 0, alone_temp2 = BMP180_Get_Temp(&bench_dev2);
+	int32_t pressure = 0, pressure2 = 0, alone_pressure2 = BMP180_Get_Pressure(&bench_dev2);
+	uint8_t done = 0, done2 = 0;
+
+	BMP180_StartPressure(&bench_dev);
+	BMP180_StartPressure(&bench_dev2);
+	while (!(done && done2))
+	{
+		done = done || BMP180_Poll(&bench_dev);
+		done2 = done2 || BMP180_Poll(&bench_dev2);
+	}
+	return (BMP180_Collect(&bench_dev, &temp, &pressure) && BMP180_Collect(&bench_dev2, &temp2, &pressure2) && !bench_dev.error && !bench_dev2.error
+		&& (temp == 150) && (pressure > 69960) && (pressure < 69968) && (temp2 == alone_temp2) && (pressure2 == alone_pressure2) && (temp2 != temp));
+}
+
+uint8_t Bench_DHT_Read(void)
+{
+	int16_t temp;
+	uint16_t hum;
+
+	return ((DHT_GetMeteoData(&temp, &hum) == DHT_OK) && (temp == bench_dht.temperature) && (hum == (uint16_t)bench_dht.humidity));
+}
+
+#if DHT_RETRY_ATTEMPTS && DHT_STATS_ENABLE
+/*
+* The first frame has a wrong CRC and the retry gets a good one, then the sensor is away for all the attempts of a reading
+* The counters must show each failed attempt and each retry
+*/
+uint8_t Bench_DHT_Retry(void)
+{
+	DHT_Stats stats;
+	int16_t temp;
+	uint16_t hum;
+	uint8_t ok;
+
+	DHT_Clear_Stats();
+	bench_dht.crc_error = 1;
+	ok = (DHT_GetMeteoData(&temp, &hum) == DHT_OK) && (temp == bench_dht.temperature) && (hum == (uint16_t)bench_dht.humidity);
+	DHT_Get_Stats(DHT_PIN_NUM, &stats);
+	ok = ok && (stats.crc_failures == 1) && (stats.timeouts == 0) && (stats.retries == 1) && (stats.consecutive_failures == 0);
+
+	bench_dht.present = 0;
+	ok = ok && (DHT_GetMeteoData(&temp, &hum) == DHT_ERR_TIMEOUT);
+	bench_dht.present = 1;
+	DHT_Get_Stats(DHT_PIN_NUM, &stats);
+	return ok && (stats.crc_failures == 1) && (stats.timeouts == DHT_RETRY_ATTEMPTS + 1) && (stats.retries == DHT_RETRY_ATTEMPTS + 1)
+		&& (stats.consecutive_failures == DHT_RETRY_ATTEMPTS + 1);
+}
+#endif
+
+#if DHT_MULTI_ENABLE
+/*
+* Two sensors with other values are read at once, each reading must have the values of its sensor
+* With retries the first frame of the second sensor has a wrong CRC, so only that sensor is read again
+*/
+uint8_t Bench_DHT_Read_Multi(void)
+{
+	DHT_Reading readings[8];
+	uint8_t mask = (1 << DHT_PIN_NUM) | (1 << PIN_BIT(BENCH_DHT2_PIN)), ok;
+
+#if DHT_RETRY_ATTEMPTS
+	bench_dht2.crc_error = 1;
+#endif
+#if DHT_STATS_ENABLE
+	DHT_Clear_Stats();
+#endif
+	ok = (DHT_Read_Multi(mask, readings) == mask)
+		&& (readings[DHT_PIN_NUM].temperature == bench_dht.temperature) && (readings[DHT_PIN_NUM].humidity == (uint16_t)bench_dht.humidity)
+		&& (readings[PIN_BIT(BENCH_DHT2_PIN)].temperature == bench_dht2.temperature) && (readings[PIN_BIT(BENCH_DHT2_PIN)].humidity == (uint16_t)bench_dht2.humidity);
+#if DHT_RETRY_ATTEMPTS && DHT_STATS_ENABLE
+	DHT_Stats stats, stats2;
+
+	DHT_Get_Stats(DHT_PIN_NUM, &stats);
+	DHT_Get_Stats(PIN_BIT(BENCH_DHT2_PIN), &stats2);
+	ok = ok && (stats.crc_failures == 0) && (stats.retries == 0) && (stats2.crc_failures == 1) && (stats2.retries == 1) && (stats2.consecutive_failures == 0);
+#endif
+	return ok;
+}
+#endif
+
+/*
+* Numbers are written on the last row with their alignment, a negative one with a decimal, an integer and one smaller than its decimals
+* LCD_WriteFixed() writes to the LCD itself, also with LCD_SHADOW_ENABLE, so the copy keeps the old text of these cells and never sends it again
+*/
+uint8_t Bench_LCD_Write_Fixed(void)
+{
+	LCD_SetCursor(0, LCD_ROWS);
+	LCD_WriteFixed(-253, 1, 6);
+	LCD_WriteInt(1013, 5);
+	LCD_WriteFixed(5, 2, 5);
+	memcpy(bench_text[LCD_ROWS - 1], " -25.3 1013 0.05", 16);
+	return Bench_LCD_Done();
+}
+
+/*
+* A slave holds SDA LOW during a pressure reading, the reading must fail with a timeout and give the last good value
+* TWIRecover() frees the bus with its clock pulses, so the next reading must be correct again
+*/
+uint8_t Bench_TWI_Recovery(void)
+{
+	int32_t pressure;
+	uint8_t ok;
+
+	Host_TWI_Hold(5);
+	pressure = BMP180_Get_Pressure(&bench_dev);
+	ok = (bench_dev.error == TWI_ERR_TIMEOUT) && (pressure > 69960) && (pressure < 69968); //The value of bmp180_cycle
+	Host_TWI_Hold(0);
+	pressure = BMP180_Get_Pressure(&bench_dev);
+	return ok && (bench_dev.error == TWI_OK) && (pressure > 69960) && (pressure < 69968);
+}
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+/*
+* The backpack leaves the bus for one character, LCD_Error() must tell it once and then be clear again
+*/
+uint8_t Bench_LCD_PCF8574_Missing(void)
+{
+	uint8_t ok = (LCD_Error() == TWI_OK); //Nothing failed before
+
+	bench_pcf.address = BENCH_NO_DEVICE_ADDR;
+	LCD_SetCursor(0, 1);
+	LCD_WriteChar(bench_text[0][0]);
+	bench_pcf.address = LCD_PCF8574_ADDR;
+	ok = ok && (LCD_Error() == TWI_ERR_NACK) && (LCD_Error() == TWI_OK);
+	LCD_SetCursor(0, 1);
+	LCD_WriteChar(bench_text[0][0]);
+	return ok && (LCD_Error() == TWI_OK) && Bench_LCD_Done();
+}
+#endif
+
+#if LCD_GLYPH_ENABLE
+const uint8_t bench_glyphs[10][8] PROGMEM = {{1}, {2}, {3}, {4}, {5}, {6}, {7}, {8}, {9}, {10}}; //Different first lines, to tell them apart in the CGRAM
+
+/*
+* The 8 CGRAM places are filled and released while the first glyph is on the screen, a ninth glyph must take another place
+* When the cell shows a letter again, the place of the first glyph is the least recently used free one and the tenth glyph takes it
+*/
+uint8_t Bench_LCD_Glyphs(void)
+{
+	char shown[2] = {0, 0}, letter[2] = {bench_text[0][0], 0};
+	uint8_t code, ok;
+
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		code = LCD_Glyph_Get(bench_glyphs[i]);
+		if (i == 0)
+			shown[0] = code;
+	}
+	Bench_LCD_Write(0, 1, shown);
+	bench_text[0][0] = shown[0];
+	ok = Bench_LCD_Done();
+	for (uint8_t i = 0; i < 8; i++)
+		LCD_Glyph_Put(bench_glyphs[i]);
+
+	code = LCD_Glyph_Get(bench_glyphs[8]);
+	LCD_Glyph_Put(bench_glyphs[8]);
+	ok = ok && (code != 0xFF) && (code != (uint8_t)shown[0]) && (bench_lcd.cgram[(shown[0] & 0b111) << 3] == 1);
+
+	Bench_LCD_Write(0, 1, letter);
+	bench_text[0][0] = letter[0];
+	ok = ok && Bench_LCD_Done();
+	code = LCD_Glyph_Get(bench_glyphs[9]);
+	LCD_Glyph_Put(bench_glyphs[9]);
+	return ok && (code == (uint8_t)shown[0]) && (bench_lcd.cgram[(shown[0] & 0b111) << 3] == 10);
+}
+#endif
+
+#if LCD_MARQUEE_ENABLE
+/*
+* A text longer than the DDRAM line scrolls through one whole cycle, after each step the shown cells of the DDRAM line must hold the text from the step on
+* The rows of the marquee don't show bench_text after it, so it runs after the other LCD workloads
+*/
+uint8_t Bench_LCD_Marquee(void)
+{
+	static char text[] = "0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ abcdefghijklmnopqrstuvwxyz";
+	uint8_t length = sizeof(text) - 1, visible = (LCD_ROWS > 2) ? 2*LCD_COLS : LCD_COLS, ok = 1;
+
+	LCD_Marquee_Start(text, 1, 1);
+	for (uint8_t step = 1; step <= length + LCD_MARQUEE_GAP; step++)
+	{
+		LCD_Marquee_Tick();
+#if LCD_QUEUE_ENABLE
+		LCD_Sync();
+#endif
+		ok = ok && (bench_lcd.shift == step % LCD_DDRAM_LINE);
+		for (uint8_t i = 0; i < visible; i++)
+		{
+			uint8_t index = (step + i) % (length + LCD_MARQUEE_GAP);
+
+			ok = ok && (bench_lcd.ddram[0][(step + i) % LCD_DDRAM_LINE] == ((index < length) ? text[index] : ' '));
+		}
+	}
+	LCD_Marquee_Stop();
+#if LCD_QUEUE_ENABLE
+	LCD_Sync();
+#endif
+	return ok && (bench_lcd.shift == 0);
+}
+#endif
+
+/*
+* An address only transaction, the way a bus scan looks for a device, to the sensor and to an address without a device
+*/
+uint8_t Bench_TWI_Probe(void)
+{
+#if TWI_ASYNC_ENABLE
+	TWI_Transaction probe = {BMP180_ADDR, 0, 0, 0, 0, 0, TWI_TRANS_IDLE, TWI_OK, TWI_SPEED_DEFAULT}; //Nothing to write or read, so the buffers are null
+	uint8_t present, missing;
+
+	TWISubmit(&probe);
+	present = TWIWait(&probe);
+	probe.address = BENCH_NO_DEVICE_ADDR;
+	TWISubmit(&probe);
+	missing = TWIWait(&probe);
+#else
+	uint8_t present = TWIWriteBytes(BMP180_ADDR, 0, 0), missing = TWIWriteBytes(BENCH_NO_DEVICE_ADDR, 0, 0);
+#endif
+	return ((present == TWI_OK) && (missing == TWI_ERR_NACK));
+}
+
+/*
+* The TWI transactions sent with a faster SCL than their device allows
+*/
+uint32_t Bench_Speed_Violations(void)
+{
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+	return bench_bmp.speed_violations + bench_bmp2.speed_violations + bench_pcf.speed_violations;
+#else
+	return bench_bmp.speed_violations + bench_bmp2.speed_violations;
+#endif
+}
+
+/*
+* Run a workload and print its line, with the differences of the statistics of the simulation
+*/
+void Bench_Run(const char *config, const char *workload, uint8_t (*function)(void))
+{
+	Host_Stats start = host_stats;
+	uint32_t violations = bench_lcd.violations, early_reads = bench_bmp.early_reads + bench_bmp2.early_reads, speed_violations = Bench_Speed_Violations();
+	uint8_t ok = function();
+
+	ok = ok && (bench_lcd.violations == violations) && (bench_bmp.early_reads + bench_bmp2.early_reads == early_reads) && (Bench_Speed_Violations() == speed_violations);
+	printf("%s,%s,%.1f,%.1f,%.1f,%lu,%lu,%lu,%lu,%u\n", config, workload,
+		HOST_CYCLES_TO_US(host_stats.cycles - start.cycles),
+		HOST_CYCLES_TO_US(host_stats.blocked_cycles - start.blocked_cycles),
+		HOST_CYCLES_TO_US(host_stats.twi_bus_cycles - start.twi_bus_cycles),
+		(unsigned long)(host_stats.twi_bytes - start.twi_bytes),
+		(unsigned long)(host_stats.twi_transactions - start.twi_transactions),
+		(unsigned long)(host_stats.gpio_toggles - start.gpio_toggles),
+		(unsigned long)(host_stats.interrupts - start.interrupts), ok);
+}
+
+/*
+* The first argument is the name of the configuration, printed at each line
+*/
+int main(int argc, char **argv)
+{
+	const char *config = (argc > 1) ? argv[1] : "default";
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+	Host_Attach_TWI(&bench_pcf);
+#else
+	bench_lcd.Attach(HOST_LCD_RS, HOST_PIN(LCD_RS_PIN));
+	bench_lcd.Attach(HOST_LCD_RW, HOST_PIN(LCD_RW_PIN));
+	bench_lcd.Attach(HOST_LCD_E, HOST_PIN(LCD_E_PIN));
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+	bench_lcd.Attach(0, HOST_PIN(LCD_D0_PIN));
+	bench_lcd.Attach(1, HOST_PIN(LCD_D1_PIN));
+	bench_lcd.Attach(2, HOST_PIN(LCD_D2_PIN));
+	bench_lcd.Attach(3, HOST_PIN(LCD_D3_PIN));
+#endif
+	bench_lcd.Attach(4, HOST_PIN(LCD_D4_PIN));
+	bench_lcd.Attach(5, HOST_PIN(LCD_D5_PIN));
+	bench_lcd.Attach(6, HOST_PIN(LCD_D6_PIN));
+	bench_lcd.Attach(7, HOST_PIN(LCD_D7_PIN));
+#endif
+	bench_dht.Attach(HOST_PIN(DHT_DATA_PIN));
+#if DHT_MULTI_ENABLE
+	bench_dht2.humidity = 618; //61.8%
+	bench_dht2.temperature = -52; //-5.2C
+	bench_dht2.Attach(HOST_PIN(BENCH_DHT2_PIN));
+#endif
+	Host_Attach_TWI(&bench_bmp);
+	bench_bmp2.ut = 28898; //About 25C
+	Host_Attach_TWI(&bench_bmp2);
+
+	//Start up, not measured, the calibration load of the workload is the one after the start up
+	Host_Reset();
+	sei();
+	TWIInit();
+	InitLCD();
+	DHT_Init();
+	BMP180_Init(&bench_dev, BMP180_ADDR);
+	BMP180_Init(&bench_dev2, BENCH_BMP180_ADDR2);
+
+	printf("config,workload,wall_us,blocked_us,twi_bus_us,twi_bytes,twi_transactions,gpio_toggles,interrupts,ok\n");
+	Bench_Run(config, "lcd_full_refresh", Bench_LCD_Full_Refresh);
+	Bench_Run(config, "lcd_digit_update", Bench_LCD_Digit_Update);
+	Bench_Run(config, "bmp180_calibration", Bench_BMP180_Calibration);
+	Bench_Run(config, "bmp180_cycle", Bench_BMP180_Cycle);
+	Bench_Run(config, "bmp180_two_sensors", Bench_BMP180_Two_Sensors);
+	Bench_Run(config, "dht_read", Bench_DHT_Read);
+#if DHT_RETRY_ATTEMPTS && DHT_STATS_ENABLE
+	Bench_Run(config, "dht_retry", Bench_DHT_Retry);
+#endif
+#if DHT_MULTI_ENABLE
+	Bench_Run(config, "dht_read_multi", Bench_DHT_Read_Multi);
+#endif
+	Bench_Run(config, "twi_probe", Bench_TWI_Probe);
+	Bench_Run(config, "twi_recovery", Bench_TWI_Recovery);
+	Bench_Run(config, "lcd_write_fixed", Bench_LCD_Write_Fixed);
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+	Bench_Run(config, "lcd_pcf8574_missing", Bench_LCD_PCF8574_Missing);
+#endif
+#if LCD_GLYPH_ENABLE
+	Bench_Run(config, "lcd_glyphs", Bench_LCD_Glyphs);
+#endif
+#if LCD_MARQUEE_ENABLE
+	Bench_Run(config, "lcd_marquee", Bench_LCD_Marquee);
+#endif
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../BMP_180/BMP180.h"
+
+/*
+* Replay of a TWI trace recorded with TWI_TRACE_ENABLE, see ../BMP_180/TWI.h
+* The transactions with the BMP180 are taken from the trace and their bytes go through the calculations of BMP180.c, so the values are the ones the MCU calculated, bit for bit
+* Build it with the same options of BMP180.h as the firmware, because the resolution and the filter change the calculations
+* Each value is printed as a CSV line with the time of its transaction and the time the transaction took on the bus, in ticks of TWI_TRACE_TIME()
+*/
+
+//Internal functions of the BMP180 library
+extern void BMP180_Unpack_Calibration(BMP180_Dev *dev, const uint8_t *calib_bytes);
+extern int16_t BMP180_Calc_Temp(BMP180_Dev *dev, uint16_t UT);
+extern int32_t BMP180_Calc_Pressure(BMP180_Dev *dev, int32_t UP);
+#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE
+extern int32_t BMP180_Filter_Update(BMP180_Dev *dev, int32_t pressure);
+#endif
+
+/*
+* One transaction of the trace, from its start condition to its stop condition
+*/
+typedef struct
+{
+	uint16_t start, end; //Times of the start and the stop condition
+	uint8_t address; //The first address byte, with the read/write bit
+	uint8_t expect_address; //Set after a start condition, the next byte sent is an address
+	uint8_t write[4]; //The data bytes sent, after the address
+	uint8_t write_count;
+	uint8_t read[CALIB_BYTES_COUNT]; //The data bytes received
+	uint8_t read_count;
+	uint8_t error; //The first status that shows a failure, zero if there was none
+	uint8_t recovered; //Set when the transaction timed out and the bus was recovered
+} Replay_Transaction;
+
+BMP180_Dev replay_dev;
+uint8_t replay_command = 0; //The last command written to the control register
+uint8_t replay_calibrated = 0; //Set when the calibration values were in the trace or in the calibration file
+uint8_t replay_temp_done = 0; //Set when a temperature was calculated, the pressure needs its B5
+
+void Replay_Print(Replay_Transaction *trans, const char *value_type, long value)
+{
+	printf("%u,%u,%s,%ld\n", trans->start, (uint16_t)(trans->end - trans->start), value_type, value);
+}
+
+/*
+* Give the bytes of a finished transaction with the sensor to the library, like the functions of BMP180.c do after they read them
+*/
+void Replay_Transaction_End(Replay_Transaction *trans)
+{
+	if (trans->recovered)
+	{
+		Replay_Print(trans, "bus_timeout", trans->error);
+		return;
+	}
+	if (trans->error)
+	{
+		Replay_Print(trans, "bus_error", trans->error);
+		return;
+	}
+	if ((trans->write_count == 2) && (trans->read_count == 0) && (trans->write[0] == RAW_VALUE_READ_REGISTER)) //A command
+	{
+		replay_command = trans->write[1];
+		Replay_Print(trans, "command", replay_command);
+		return;
+	}
+	if ((trans->write_count != 1) || (trans->read_count == 0))
+		return;
+
+	if ((trans->write[0] == FIRST_CALIB_REG_ADDR) && (trans->read_count == CALIB_BYTES_COUNT))
+	{
+		BMP180_Unpack_Calibration(&replay_dev, trans->read);
+		replay_calibrated = 1;
+		Replay_Print(trans, "calibration", trans->read_count);
+	}
+	else if (trans->write[0] == CHIP_ID_REG)
+		Replay_Print(trans, "chip_id", trans->read[0]);
+	else if ((trans->write[0] == TEMP_READ_UNCL_MSB) && replay_calibrated)
+	{
+		if ((replay_command == TEMP_READ_COMMAND) && (trans->read_count == 2))
+		{
+			Replay_Print(trans, "temperature", BMP180_Calc_Temp(&replay_dev, ((uint16_t)trans->read[0] << 8) | ((uint16_t)trans->read[1])));
+			replay_temp_done = 1;
+		}
+		else if (((replay_command & 0x3F) == PRESS_READ_COMMAND) && (trans->read_count == 3) && replay_temp_done)
+		{
+			int32_t pressure;
+
+			if ((replay_command >> 6) != PRESS_RESOLUTION)
+				fprintf(stderr, "The firmware used the resolution %d, build the replay with the same PRESS_RESOLUTION\n", replay_command >> 6);
+			pressure = BMP180_Calc_Pressure(&replay_dev, (((int32_t)trans->read[0] << 16) | ((int32_t)trans->read[1] << 8) | ((int32_t)trans->read[2])) >> (8 - PRESS_RESOLUTION));
+			#if PRESS_FILTER_TYPE != PRESS_FILTER_NONE
+				pressure = BMP180_Filter_Update(&replay_dev, pressure);
+			#endif
+			Replay_Print(trans, "pressure", pressure);
+		}
+	}
+}
+
+/*
+* Load the 22 calibration bytes of the sensor from a file, in the order of their registers, from 0xAA to 0xBF
+* With BMP180_EEPROM_CACHE they are not read at start up, so they don't go through the bus, take them from the EEPROM copy, after its chip id byte
+*/
+uint8_t Replay_Load_Calibration(const char *file_name)
+{
+	FILE *file = fopen(file_name, "rb");
+	uint8_t calib_bytes[CALIB_BYTES_COUNT];
+	
+	if (!file)
+	{
+		perror(file_name);
+		return 0;
+	}
+	if (fread(calib_bytes, 1, sizeof(calib_bytes), file) != sizeof(calib_bytes))
+	{
+		fprintf(stderr, "%s: the calibration file must have %d bytes\n", file_name, CALIB_BYTES_COUNT);
+		fclose(file);
+		return 0;
+	}
+	fclose(file);
+	BMP180_Unpack_Calibration(&replay_dev, calib_bytes);
+	replay_calibrated = 1;
+	return 1;
+}
+
+/*
+* The first argument is the file with the bytes of TWITraceDump(), the second one is the 7-bit address of the sensor, if it isn't BMP180_ADDR
+* The third one is a file with the calibration bytes, for a trace without them, the ones in the trace replace them if there are any
+* The trace may start in the middle of a transaction, when the ring buffer was full, so everything before the first start condition is skipped
+*/
+int main(int argc, char **argv)
+{
+	FILE *file;
+	uint8_t bytes[5], address = BMP180_ADDR, in_transaction = 0;
+	Replay_Transaction trans;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s trace_file [address [calibration_file]]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		address = (uint8_t)strtol(argv[2], 0, 0);
+	file = fopen(argv[1], "rb");
+	if (!file)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	memset(&replay_dev, 0, sizeof(replay_dev)); //The state of BMP180_Init(), without the bus
+	replay_dev.address = address;
+	if ((argc > 3) && !Replay_Load_Calibration(argv[3]))
+	{
+		fclose(file);
+		return 1;
+	}
+	printf("time,duration,value_type,value\n");
+	while (fread(bytes, 1, sizeof(bytes), file) == sizeof(bytes))
+	{
+		uint16_t time = bytes[0] | ((uint16_t)bytes[1] << 8);
+		uint8_t operation = bytes[2], status = bytes[3], data = bytes[4];
+
+		if (operation == TWI_TRACE_START)
+		{
+			if (!in_transaction) //A repeated start continues the same transaction
+			{
+				memset(&trans, 0, sizeof(trans));
+				trans.start = time;
+				in_transaction = 1;
+			}
+			trans.expect_address = 1;
+			if ((status != 0x08) && (status != 0x10) && !trans.error)
+				trans.error = status;
+		}
+		else if (!in_transaction) //The rest of a transaction that started before the trace
+			continue;
+		else if (operation == TWI_TRACE_STOP)
+		{
+			trans.end = time;
+			trans.recovered = data;
+			in_transaction = 0;
+			if ((trans.address >> 1) == address)
+				Replay_Transaction_End(&trans);
+		}
+		else if ((operation == TWI_TRACE_WRITE) && trans.expect_address)
+		{
+			if (trans.address == 0)
+				trans.address = data;
+			trans.expect_address = 0;
+			if ((status != 0x18) && (status != 0x40) && !trans.error)
+				trans.error = status;
+		}
+		else if (operation == TWI_TRACE_WRITE)
+		{
+			if (trans.write_count < sizeof(trans.write))
+				trans.write[trans.write_count++] = data;
+			if ((status != 0x28) && !trans.error)
+				trans.error = status;
+		}
+		else if (trans.read_count < sizeof(trans.read))
+			trans.read[trans.read_count++] = data;
+	}
+	fclose(file);
+	if (!replay_calibrated)
+		fprintf(stderr, "The trace has no calibration values, so no temperature or pressure was calculated, give them in a calibration file\n");
+	return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Build the benchmark on the host for each configuration and print the results as CSV
+# Usage: Bench/bench.sh [configurations file] > results.csv
+
+set -e
+. "$(dirname "$0")/config.sh"
+
+CONFIGS=${1:-$ROOT/Bench/configs.txt}
+CXX=${CXX:-g++}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+header=1
+bench_configs "$CONFIGS" | while read -r name options; do
+	bench_config "$WORK/$name" $options
+	(cd "$WORK/$name" && $CXX -std=gnu++11 -O1 -Wall -Wextra -Werror -x c++ LCD/LCD.c DHT_22/DHT.c BMP_180/BMP180.c BMP_180/TWI.c \
+		-x none Bench/Bench.cpp HAL/Host/Host.cpp HAL/Host/Models.cpp -o bench -lm)
+	if [ -n "$header" ]; then
+		"$WORK/$name/bench" "$name"
+		header=
+	else
+		"$WORK/$name/bench" "$name" | tail -n +2
+	fi
+done
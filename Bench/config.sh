@@ -0,0 +1,25 @@
+# Shared by bench.sh and size.sh, not run on its own
+# bench_config <directory> [NAME=VALUE ...] copies the libraries to the directory and replaces the #define of each option in their headers
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+bench_config()
+{
+	config_dir=$1
+	shift
+	rm -rf "$config_dir"
+	mkdir -p "$config_dir"
+	cp -r "$ROOT/BMP_180" "$ROOT/DHT_22" "$ROOT/LCD" "$ROOT/Pins" "$ROOT/HAL" "$ROOT/Bench" "$config_dir/"
+	for option in "$@"; do
+		option_name=${option%%=*} #The variables of the function are global, so their names must not be used by the scripts
+		option_value=${option#*=}
+		files=$(grep -l "^#define $option_name " "$config_dir"/*/*.h) || { echo "Unknown option $option_name" >&2; return 1; }
+		sed -i "s/^#define $option_name .*/#define $option_name $option_value \/\/Set by the benchmark configuration/" $files
+	done
+}
+
+# bench_configs prints the lines of the configurations file without the comments and the empty lines
+bench_configs()
+{
+	grep -v -e '^#' -e '^[[:space:]]*$' "$1"
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Build each library with avr-gcc for each configuration and print the flash and SRAM it takes as CSV
+# Usage: Bench/size.sh [configurations file] > sizes.csv
+# flash is text + data, the code and the initial values of the variables, sram is data + bss
+
+set -e
+. "$(dirname "$0")/config.sh"
+
+CONFIGS=${1:-$ROOT/Bench/configs.txt}
+AVR_GCC=${AVR_GCC:-avr-gcc}
+AVR_SIZE=${AVR_SIZE:-avr-size}
+MCU=${MCU:-atmega644p}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+command -v "$AVR_GCC" > /dev/null || { echo "$AVR_GCC not found, set AVR_GCC" >&2; exit 1; }
+
+echo "config,file,text,data,bss,flash,sram"
+bench_configs "$CONFIGS" | while read -r name options; do
+	bench_config "$WORK/$name" $options
+	for file in LCD/LCD.c DHT_22/DHT.c BMP_180/BMP180.c BMP_180/TWI.c; do
+		object="$WORK/$name/$(basename "$file" .c).o"
+		"$AVR_GCC" -mmcu="$MCU" -Os -std=gnu99 -c "$WORK/$name/$file" -o "$object"
+		"$AVR_SIZE" "$object" | awk -v config="$name" -v file="$file" \
+			'NR == 2 { printf "%s,%s,%d,%d,%d,%d,%d\n", config, file, $1, $2, $3, $1 + $2, $2 + $3 }'
+	done
+done
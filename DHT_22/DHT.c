@@ -1,17 +1,109 @@
 #include "DHT.h"
 
-int8_t DHT_Read_Data(void);
+uint8_t DHT_Read_Data(void);
+int8_t DHT_Check_Frame(const uint8_t *frame, int16_t *values);
+uint8_t DHT_Read_Frame_ICP(void);
+uint8_t DHT_Update(void);
+uint8_t DHT_Read_Retry(void);
+void DHT_Wait_ms(uint16_t ms);
+void DHT_Count_Attempt(uint8_t pin, uint8_t status);
+uint8_t DHT_Read_Multi_Once(uint8_t pin_mask, DHT_Reading *readings);
 
 int16_t data[2] = {0}; //Array to store the received values
+int16_t dht_values[2] = {0}; //The last correct humidity and temperature, data is overwritten while a frame is received
+uint8_t dht_have_values = 0; //Set when dht_values holds a correct reading
+
+#if DHT_STATS_ENABLE
+DHT_Stats dht_stats[8]; //The counters of each sensor, indexed by its PIN bit
+#endif
+
+#if DHT_CACHE_ENABLE
+uint8_t dht_last_status = DHT_ERR_TIMEOUT; //Status of the last reading of the sensor
+uint8_t dht_read_once = 0; //Set after the first reading of the sensor
+uint32_t dht_read_time = 0; //Time of the last reading, correct or not
+uint32_t dht_good_time = 0; //Time of the last correct reading
+
+#ifndef DHT_TIME_MS
+volatile uint32_t dht_time_ms = 0; //Time in ms, advanced by DHT_Tick()
+uint32_t DHT_Read_Time(void);
+#define DHT_TIME_MS() DHT_Read_Time()
+
+/*
+* Advance the time of the cache by the given ms, call it from a timer interrupt
+*/
+void DHT_Tick(uint8_t ms)
+{
+	dht_time_ms += ms;
+}
+
+/*
+* Read the time atomically, it is changed by the timer interrupt
+*/
+uint32_t DHT_Read_Time(void)
+{
+	uint32_t time;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		time = dht_time_ms;
+	}
+	return time;
+}
+#endif
+#endif
+
+//Timer1 clock select bits for the selected prescaler, Timer1 times the frames of the input capture decoder and the multi sensor reading
+#if DHT_TIMER_PRESCALER == 1
+#define DHT_TIMER_CLOCK (1 << CS10)
+#elif DHT_TIMER_PRESCALER == 8
+#define DHT_TIMER_CLOCK (1 << CS11)
+#elif DHT_TIMER_PRESCALER == 64
+#define DHT_TIMER_CLOCK ((1 << CS11) | (1 << CS10))
+#endif
+
+#if DHT_DECODER == DHT_DECODER_ICP
+#if (PIN_PORT_NUM(DHT_DATA_PIN) != PIN_PORT_NUM_D) || (PIN_BIT(DHT_DATA_PIN) != 6)
+#error "The input capture decoder needs the sensor on the ICP1 PIN, set DHT_DATA_PIN to D, 6"
+#endif
+
+volatile uint16_t dht_edges[DHT_EDGE_COUNT]; //Timer1 values at the falling edges of the frame
+volatile uint8_t dht_edge_count = 0; //Number of falling edges captured
+
+/*
+* Save the time of each falling edge, the bits are decoded after the whole frame is received
+*/
+ISR(TIMER1_CAPT_vect)
+{
+	if (dht_edge_count < DHT_EDGE_COUNT)
+		dht_edges[dht_edge_count++] = ICR1;
+}
+#endif
 
 void DHT_Init(void)
 {
-	DHT_DDR &= ~(1 << DHT_PIN_NUM); //Set PORT to INPUT
-	DHT_PORT |= 1 << DHT_PORTNU; //And pull it HIGH
+	PIN_INPUT(DHT_DATA_PIN); //Set PORT to INPUT
+	PIN_HIGH(DHT_DATA_PIN); //And pull it HIGH
 }
 
-int8_t DHT_Read_Data(void)
+/*
+* Read one frame from the sensor, returns DHT_OK, DHT_ERR_TIMEOUT or DHT_ERR_CRC
+*/
+uint8_t DHT_Read_Data(void)
 {
+	PIN_HIGH(DHT_DATA_PIN); //And pull it HIGH
+#if DHT_CACHE_ENABLE
+	if (!dht_read_once) //After the first reading the line has been HIGH for at least DHT_MIN_INTERVAL_MS
+#endif
+	_delay_ms(250); //Delay to give the sensor some time to stabilize
+	
+	//Start the communication procedure
+	PIN_OUTPUT(DHT_DATA_PIN); //Set the Pin of the DHT to output
+	PIN_LOW(DHT_DATA_PIN); //Pull the DHT pin LOW
+	_delay_ms(20); //Delay at least 1ms
+	
+#if DHT_DECODER == DHT_DECODER_ICP
+	return DHT_Read_Frame_ICP(); //Release the line and let the input capture unit time the frame
+#else
 	uint8_t counter = 0; //Counter variable
 	
 	uint8_t bit = 0; //Save each byte received to this variable
@@ -19,37 +111,30 @@ int8_t DHT_Read_Data(void)
 	uint8_t rcvd_crc = 0; //Save the received CRC
 	uint8_t temp_crc = 0; //A temporary variable for CRC operations
 	
-	DHT_PORT |= 1 << DHT_PORTNU; //And pull it HIGH
-	_delay_ms(250); //Delay to give the sensor some time to stabilize
-	
-	//Start the communication procedure
-	DHT_DDR |= (1 << DHT_PIN_NUM); //Set the Pin of the DHT to output
-	DHT_PORT &= ~(1 << DHT_PORTNU); //Pull the DHT pin LOW
-	_delay_ms(20); //Delay at least 1ms
-	DHT_PORT |= 1 << DHT_PORTNU; //Pull the DHT pin HIGH
+	PIN_HIGH(DHT_DATA_PIN); //Pull the DHT pin HIGH
 	_delay_us(40); //Delay 20 - 40us according to the data sheet
-	DHT_DDR &= ~(1 << DHT_PIN_NUM); //Set PORT to input to start listening
-	DHT_PORT |= 1 << DHT_PORTNU; //Enable the pull-up resistor at the PIN
+	PIN_INPUT(DHT_DATA_PIN); //Set PORT to input to start listening
+	PIN_HIGH(DHT_DATA_PIN); //Enable the pull-up resistor at the PIN
 	_delay_us(20); //Delay before checking the PIN to make sure we are in the phase
 	
-	while(!(DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255)) //Wait until the PIN is HIGH or timeout
+	while(!PIN_READ(DHT_DATA_PIN) && (counter < 255)) //Wait until the PIN is HIGH or timeout
 		counter++; //Increase the counter for timeout
 	if (counter >= 255) //If timeout limit reached, exit from the function
-		return 0;
+		return DHT_ERR_TIMEOUT;
 	_delay_us(100); //Delay more than 80us in order to capture the bit that is sent
 	
 	//Get the humidity reading
 	for(uint8_t i = 0; i < 16; i++)
 	{
 		counter = 0; //Reset the counter in each iteration
-		while(!(DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255)) //Wait until the PIN is HIGH or timeout
+		while(!PIN_READ(DHT_DATA_PIN) && (counter < 255)) //Wait until the PIN is HIGH or timeout
 			counter++; 
 		_delay_us(40); //Delay 40us to check...
 		
-		if((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255)) //...if PIN is still HIGH that means we have a bit of one (1)
+		if(PIN_READ(DHT_DATA_PIN) && (counter < 255)) //...if PIN is still HIGH that means we have a bit of one (1)
 		{
 			bit = 1; //Save that PIN and...
-			while((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255)) //...Wait until the PIN gets to LOW
+			while(PIN_READ(DHT_DATA_PIN) && (counter < 255)) //...Wait until the PIN gets to LOW
 				counter++;
 		}
 		else //If the pin got to LOW after the 40us delay the bit is for sure a zero bit
@@ -76,14 +161,14 @@ int8_t DHT_Read_Data(void)
 	{
 		counter = 0; //Reset the counter in each iteration
 		//Same procedure as above
-		while(!(DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+		while(!PIN_READ(DHT_DATA_PIN) && (counter < 255))
 			counter++;
 		_delay_us(40);
 		
-		if((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+		if(PIN_READ(DHT_DATA_PIN) && (counter < 255))
 		{
 			bit = 1;
-			while((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+			while(PIN_READ(DHT_DATA_PIN) && (counter < 255))
 				counter++;
 		}
 		else
@@ -109,14 +194,14 @@ int8_t DHT_Read_Data(void)
 	for(uint8_t i = 0; i < 8; i++)
 	{
 		counter = 0;
-		while(!(DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+		while(!PIN_READ(DHT_DATA_PIN) && (counter < 255))
 			counter++;
 		_delay_us(40);
 		
-		if((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+		if(PIN_READ(DHT_DATA_PIN) && (counter < 255))
 		{
 			bit = 1;
-			while((DHT_PIN & (1 << DHT_PIN_NUM)) && (counter < 255))
+			while(PIN_READ(DHT_DATA_PIN) && (counter < 255))
 				counter++;
 		}
 		else
@@ -129,7 +214,7 @@ int8_t DHT_Read_Data(void)
 	}
 	
 	if (counter >= 255)
-		return 0;
+		return DHT_ERR_TIMEOUT;
 	
 	if (calc_crc == rcvd_crc) //If CRC succeeds...
 	{
@@ -139,41 +224,329 @@ int8_t DHT_Read_Data(void)
 			data[1] &= ~(0x8000);
 			data[1] *= (-1);
 		}
-		return 1; //...return 1 to indicate it	
+		return DHT_OK; //...return DHT_OK to indicate it	
 	}
 		
 	else
-		return 0; //Otherwise send a zero to indicate failure
+		return DHT_ERR_CRC; //Otherwise indicate the failure
 	_delay_ms(100);
+#endif
 }
 
-void DHT_Humidity(uint16_t *Hum)
+/*
+* Check the CRC of a received frame and if it is correct save the humidity at values[0] and the temperature at values[1]
+* The frame has five bytes, humidity MSB and LSB, temperature MSB and LSB and the CRC
+*/
+int8_t DHT_Check_Frame(const uint8_t *frame, int16_t *values)
 {
-	if(DHT_Read_Data())
-		*Hum = data[0];
-	else
-		*Hum = 1250; //Return a strange value to let know that the CRC failed
+	if ((uint8_t)(frame[0] + frame[1] + frame[2] + frame[3]) != frame[4]) //The CRC is the sum of the first four bytes
+		return 0;
+	
+	values[0] = ((int16_t)frame[0] << 8) | frame[1];
+	values[1] = ((int16_t)(frame[2] & 0x7F) << 8) | frame[3];
+	if (frame[2] & 0x80) //The highest bit is the sign of the temperature
+		values[1] *= (-1);
+	return 1;
 }
 
-void DHT_Temperature(int16_t *Temp)
+#if DHT_DECODER == DHT_DECODER_ICP
+/*
+* Release the line after the start pulse and capture the falling edges of the frame with the Timer1 input capture unit
+* The interrupts are free to run during the frame, because the edge times are taken by the hardware
+* After the frame the bits are found from the time between their falling edges, which doesn't depend on the clock or the optimization
+* The Timer1 settings of the application are restored at the end, but TCNT1 runs with the DHT_TIMER_PRESCALER during the frame
+*/
+uint8_t DHT_Read_Frame_ICP(void)
 {
-	if(DHT_Read_Data())
-		*Temp = data[1];
-	else
-		*Temp = 1100; //Return a strange value to let know that the CRC failed
+	uint8_t frame[5] = {0}; //The received bytes
+	uint16_t start_time = 0;
+	uint8_t sreg = SREG; //Save the interrupt state, to restore it at the end
+	uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B; //Save the Timer1 settings of the application, for example the clock of TWI_TRACE_TIME()
+	
+	//Set Timer1 to count freely and capture the falling edges, with the noise canceler on
+	TCCR1A = 0;
+	TCCR1B = (1 << ICNC1) | DHT_TIMER_CLOCK;
+	dht_edge_count = 0;
+	TIFR1 = (1 << ICF1); //Clear any old capture
+	TIMSK1 |= (1 << ICIE1);
+	sei();
+	
+	PIN_INPUT(DHT_DATA_PIN); //Release the line, the pull-up resistor pulls it HIGH and the sensor answers
+	PIN_HIGH(DHT_DATA_PIN);
+	
+	start_time = TCNT1;
+	while ((dht_edge_count < DHT_EDGE_COUNT) && ((uint16_t)(TCNT1 - start_time) < DHT_US_TO_TICKS(DHT_FRAME_TIMEOUT_US))); //Wait for the whole frame
+	
+	TIMSK1 &= ~(1 << ICIE1);
+	TCCR1A = tccr1a;
+	TCCR1B = tccr1b;
+	SREG = sreg;
+	if (dht_edge_count < DHT_EDGE_COUNT) //Timeout
+		return DHT_ERR_TIMEOUT;
+	
+	//Each bit is between two falling edges, starting from the second edge
+	for (uint8_t i = 0; i < 40; i++)
+	{
+		frame[i >> 3] <<= 1;
+		if ((uint16_t)(dht_edges[i + 2] - dht_edges[i + 1]) > DHT_US_TO_TICKS(DHT_BIT_ONE_US))
+			frame[i >> 3] |= 1;
+	}
+	return DHT_Check_Frame(frame, data) ? DHT_OK : DHT_ERR_CRC;
+}
+#endif
 
+/*
+* Wait for a number of ms that is not known at compile time
+*/
+void DHT_Wait_ms(uint16_t ms)
+{
+	while (ms--)
+		_delay_ms(1);
 }
 
-void DHT_GetMeteoData(int16_t *Temper, uint16_t *Humd)
+/*
+* Count the result of one reading attempt of the sensor at PIN bit (pin)
+*/
+void DHT_Count_Attempt(uint8_t pin, uint8_t status)
 {
-	if(DHT_Read_Data())
+#if DHT_STATS_ENABLE
+	DHT_Stats *stats = &dht_stats[pin];
+	
+	if (status == DHT_OK)
 	{
-		*Humd = data[0];
-		*Temper = data[1];
+		stats->consecutive_failures = 0;
+		return;
 	}
+	if (status == DHT_ERR_TIMEOUT)
+		stats->timeouts++;
 	else
+		stats->crc_failures++;
+	if (stats->consecutive_failures < 255)
+		stats->consecutive_failures++;
+#else
+	(void)pin;
+	(void)status;
+#endif
+}
+
+/*
+* Read the sensor and try again up to DHT_RETRY_ATTEMPTS times if it fails
+* The sensor can't be read faster than DHT_MIN_INTERVAL_MS, so each retry waits for that plus a longer backoff each time
+* The worst case adds DHT_RETRY_ATTEMPTS readings and DHT_RETRY_ATTEMPTS * DHT_MIN_INTERVAL_MS + DHT_RETRY_BACKOFF_MS * (DHT_RETRY_ATTEMPTS - 1) * DHT_RETRY_ATTEMPTS / 2 ms
+*/
+uint8_t DHT_Read_Retry(void)
+{
+	uint8_t status = DHT_Read_Data();
+	
+	DHT_Count_Attempt(DHT_PIN_NUM, status);
+#if DHT_RETRY_ATTEMPTS
+	for (uint8_t attempt = 0; (status != DHT_OK) && (attempt < DHT_RETRY_ATTEMPTS); attempt++)
+	{
+		DHT_Wait_ms(DHT_MIN_INTERVAL_MS + attempt * DHT_RETRY_BACKOFF_MS);
+#if DHT_STATS_ENABLE
+		dht_stats[DHT_PIN_NUM].retries++;
+#endif
+		status = DHT_Read_Data();
+		DHT_Count_Attempt(DHT_PIN_NUM, status);
+	}
+#endif
+	return status;
+}
+
+#if DHT_STATS_ENABLE
+/*
+* Copy the counters of the sensor at PIN bit (pin)
+*/
+void DHT_Get_Stats(uint8_t pin, DHT_Stats *stats)
+{
+	*stats = dht_stats[pin & 7];
+}
+
+void DHT_Clear_Stats(void)
+{
+	memset(dht_stats, 0, sizeof(dht_stats));
+}
+#endif
+
+/*
+* Get new values from the sensor and keep them in dht_values if they are correct
+* With the cache enabled the sensor is read only if the last reading is older than DHT_MIN_INTERVAL_MS,
+* otherwise DHT_CACHED is returned for a correct last reading, or the status of the last reading if it failed
+*/
+uint8_t DHT_Update(void)
+{
+	uint8_t status;
+	
+#if DHT_CACHE_ENABLE
+	uint32_t now = DHT_TIME_MS();
+	
+	if (dht_read_once && ((uint32_t)(now - dht_read_time) < DHT_MIN_INTERVAL_MS))
+		return (dht_last_status == DHT_OK) ? DHT_CACHED : dht_last_status;
+	
+	status = DHT_Read_Retry();
+	dht_read_once = 1;
+	dht_read_time = DHT_TIME_MS(); //The reading takes some ms, count the interval from its end
+	dht_last_status = status;
+	if (status == DHT_OK)
 	{
-		*Humd = 1250; //Return a strange value to let know that the CRC failed
-		*Temper = 1100; //Return a strange value to let know that the CRC failed
+		dht_values[0] = data[0];
+		dht_values[1] = data[1];
+		dht_have_values = 1;
+		dht_good_time = dht_read_time;
+	}
+#else
+	status = DHT_Read_Retry();
+	dht_values[0] = data[0];
+	dht_values[1] = data[1];
+	dht_have_values = (status == DHT_OK); //Without the cache only the current reading is given
+#endif
+	return status;
+}
+
+#if DHT_CACHE_ENABLE
+/*
+* Time in ms since the last correct reading, 0xFFFFFFFF if there is none
+*/
+uint32_t DHT_Get_Age(void)
+{
+	if (!dht_have_values)
+		return 0xFFFFFFFF;
+	return DHT_TIME_MS() - dht_good_time;
+}
+#endif
+
+/*
+* The values are saved if the status is DHT_OK or DHT_CACHED, with the cache enabled the last correct values are also saved after a failed reading
+* Otherwise the pointers are not changed
+*/
+uint8_t DHT_Humidity(uint16_t *Hum)
+{
+	uint8_t status = DHT_Update();
+	
+	if (dht_have_values)
+		*Hum = dht_values[0];
+	return status;
+}
+
+uint8_t DHT_Temperature(int16_t *Temp)
+{
+	uint8_t status = DHT_Update();
+	
+	if (dht_have_values)
+		*Temp = dht_values[1];
+	return status;
+}
+
+uint8_t DHT_GetMeteoData(int16_t *Temper, uint16_t *Humd)
+{
+	uint8_t status = DHT_Update();
+	
+	if (dht_have_values)
+	{
+		*Humd = dht_values[0];
+		*Temper = dht_values[1];
+	}
+	return status;
+}
+
+#if DHT_MULTI_ENABLE
+/*
+* Read all the sensors of the pin mask at the same time and try again the failed ones up to DHT_RETRY_ATTEMPTS times
+* The retries wait like the ones of the single sensor and only the sensors that failed are read again
+* Returns the mask of the sensors that were read correctly
+*/
+uint8_t DHT_Read_Multi(uint8_t pin_mask, DHT_Reading *readings)
+{
+	uint8_t ok_mask = DHT_Read_Multi_Once(pin_mask, readings);
+	
+#if DHT_RETRY_ATTEMPTS
+	for (uint8_t attempt = 0; (ok_mask != pin_mask) && (attempt < DHT_RETRY_ATTEMPTS); attempt++)
+	{
+		DHT_Wait_ms(DHT_MIN_INTERVAL_MS + attempt * DHT_RETRY_BACKOFF_MS);
+#if DHT_STATS_ENABLE
+		for (uint8_t n = 0; n < 8; n++)
+			if ((pin_mask & ~ok_mask) & (1 << n))
+				dht_stats[n].retries++;
+#endif
+		ok_mask |= DHT_Read_Multi_Once(pin_mask & ~ok_mask, readings);
+	}
+#endif
+	return ok_mask;
+}
+
+/*
+* Read all the sensors of the pin mask at the same time, the sensors must be on the DHT_PORT
+* One start pulse is sent to all of them and the whole DHT_PIN register is sampled, with a Timer1 time stamp, until every sensor has sent its frame
+* The bits of each sensor are found from the time between its falling edges, so the frames don't need to be aligned
+* The result of the sensor at PIN bit (n) is saved at readings[n], so the array must have a place up to the highest bit of the mask
+* Returns the mask of the sensors that were read correctly
+*/
+uint8_t DHT_Read_Multi_Once(uint8_t pin_mask, DHT_Reading *readings)
+{
+	uint16_t last_fall[8]; //Time of the last falling edge of each sensor
+	uint8_t edges[8] = {0}; //Number of falling edges of each sensor
+	uint8_t frames[8][5] = {{0}}; //The received bytes of each sensor
+	uint8_t done = 0; //Mask of the sensors that have sent the whole frame
+	uint8_t last = 0, now = 0, fell = 0, ok_mask = 0;
+	uint16_t time = 0, start_time = 0;
+	uint8_t tccr1a = TCCR1A, tccr1b = TCCR1B; //Save the Timer1 settings of the application
+	int16_t values[2];
+	
+	DHT_PORT |= pin_mask; //Pull them HIGH
+	_delay_ms(250); //Delay to give the sensors some time to stabilize
+	
+	//Send the start pulse to all the sensors together
+	DHT_DDR |= pin_mask;
+	DHT_PORT &= ~pin_mask;
+	_delay_ms(20);
+	
+	TCCR1A = 0; //Let Timer1 count freely for the time stamps
+	TCCR1B = DHT_TIMER_CLOCK;
+	DHT_DDR &= ~pin_mask; //Release the lines, the pull-up resistors pull them HIGH and the sensors answer
+	DHT_PORT |= pin_mask;
+	
+	start_time = TCNT1;
+	while ((done != pin_mask) && ((uint16_t)((time = TCNT1) - start_time) < DHT_US_TO_TICKS(DHT_FRAME_TIMEOUT_US)))
+	{
+		now = DHT_PIN & pin_mask;
+		fell = last & ~now; //The lines that were HIGH and are now LOW, the rising edges are not needed
+		last = now;
+		
+		for (uint8_t n = 0; fell; n++, fell >>= 1)
+		{
+			if (!(fell & 1) || (edges[n] >= DHT_EDGE_COUNT))
+				continue;
+			if (edges[n] >= 2) //Each bit is between two falling edges, starting from the second edge
+			{
+				frames[n][(edges[n] - 2) >> 3] <<= 1;
+				if ((uint16_t)(time - last_fall[n]) > DHT_US_TO_TICKS(DHT_BIT_ONE_US))
+					frames[n][(edges[n] - 2) >> 3] |= 1;
+			}
+			last_fall[n] = time;
+			if (++edges[n] == DHT_EDGE_COUNT)
+				done |= 1 << n;
+		}
+	}
+	TCCR1A = tccr1a;
+	TCCR1B = tccr1b;
+	
+	for (uint8_t n = 0; n < 8; n++)
+	{
+		if (!(pin_mask & (1 << n)))
+			continue;
+		if (!(done & (1 << n)))
+			readings[n].status = DHT_ERR_TIMEOUT;
+		else if (!DHT_Check_Frame(frames[n], values))
+			readings[n].status = DHT_ERR_CRC;
+		else
+		{
+			readings[n].humidity = values[0];
+			readings[n].temperature = values[1];
+			readings[n].status = DHT_OK;
+			ok_mask |= 1 << n;
+		}
+		DHT_Count_Attempt(n, readings[n].status);
 	}
+	return ok_mask;
 }
+#endif
\ No newline at end of file
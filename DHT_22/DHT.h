@@ -5,18 +5,87 @@
 #define F_CPU 8000000UL
 #endif
 
-#include <avr/io.h>
-#include <util/delay.h>
+#include <string.h>
+#include "../HAL/HAL.h"
+#include "../Pins/Pins.h"
 
-#define DHT_DDR DDRC //Set the DDR that the DHT is on the specific PORT
-#define DHT_PORT PORTC //Set the PORT that the sensor is on
-#define DHT_PIN PINC //Set the PIN that the DHT is on
-#define DHT_PORTNU 2 //Set the PORT number
-#define DHT_PIN_NUM 2 //And the PIN number
+#define DHT_DATA_PIN C, 2 //Set the PORT letter and the PIN number of the sensor, PC2 here
+
+//The registers and the bit of the sensor, taken from DHT_DATA_PIN
+#define DHT_DDR PIN_DDR_REG(DHT_DATA_PIN)
+#define DHT_PORT PIN_PORT_REG(DHT_DATA_PIN)
+#define DHT_PIN PIN_IN_REG(DHT_DATA_PIN)
+#define DHT_PIN_NUM PIN_BIT(DHT_DATA_PIN)
+
+//Frame decoder selection
+#define DHT_DECODER_POLLING 0 //Decode the bits with busy loops and fixed delays
+#define DHT_DECODER_ICP 1 //Decode the bits from the edge times captured by the Timer1 input capture unit, the sensor must be on the ICP1 PIN, D, 6, and Timer1 runs with DHT_TIMER_PRESCALER during the frame
+#define DHT_DECODER DHT_DECODER_POLLING //Select one of the decoders above
+
+//Input capture decoder parameters
+#define DHT_TIMER_PRESCALER 8 //Timer1 prescaler, 1, 8 or 64, the timer must count at least 1 tick per 5us and wrap after more than 6ms
+#define DHT_US_TO_TICKS(us) ((uint16_t)(((us)*(F_CPU/1000000UL))/DHT_TIMER_PRESCALER)) //Convert micro seconds to Timer1 ticks
+#define DHT_EDGE_COUNT 42 //Falling edges of a frame, one for the response, one before the first bit and one after each of the 40 bits
+#define DHT_BIT_ONE_US 100 //A bit is one if the time between its two falling edges is longer than this, 76us for zero and 120us for one
+#define DHT_FRAME_TIMEOUT_US 6000 //Maximum time to wait for the whole frame
+
+//Multi sensor reading parameters
+#define DHT_MULTI_ENABLE 0 //Set to (1) to read up to eight sensors of the DHT_PORT at the same time with DHT_Read_Multi()
+
+#define DHT_MIN_INTERVAL_MS 2000 //The sensor can't be read faster than once every 2s
+
+//Reading cache parameters
+#define DHT_CACHE_ENABLE 0 //Set to (1) to keep the last correct reading and read the sensor again only when it is older than DHT_MIN_INTERVAL_MS
+//#define DHT_TIME_MS() millis() //A function that returns the time in ms, if not defined call DHT_Tick() from a timer interrupt
+
+//Status of a reading
+#define DHT_OK 0 //The reading is correct
+#define DHT_ERR_TIMEOUT 1 //The sensor didn't send the whole frame
+#define DHT_ERR_CRC 2 //The frame was received but its CRC is wrong
+#define DHT_CACHED 3 //The values are from the last correct reading, which is newer than DHT_MIN_INTERVAL_MS
+
+//Retry parameters
+#define DHT_RETRY_ATTEMPTS 0 //Readings to try again after a failed one, (0) to give up at the first failure
+#define DHT_RETRY_BACKOFF_MS 500 //The wait before retry (k) is DHT_MIN_INTERVAL_MS + k * DHT_RETRY_BACKOFF_MS, with k from 0
+#define DHT_STATS_ENABLE 0 //Set to (1) to count the failures and the retries of each sensor
+
+/*
+* The result of one sensor of the multi sensor reading
+*/
+typedef struct
+{
+	int16_t temperature; //The temperature multiplied by 10
+	uint16_t humidity; //The relative humidity multiplied by 10
+	uint8_t status; //One of the status values above
+} DHT_Reading;
+
+/*
+* The failure counters of one sensor, every reading attempt is counted
+*/
+typedef struct
+{
+	uint16_t crc_failures; //Frames with a wrong CRC
+	uint16_t timeouts; //Frames that were not received in time
+	uint16_t retries; //Readings that were tried again after a failure
+	uint8_t consecutive_failures; //Failed attempts since the last correct one, stops at 255
+} DHT_Stats;
 
 extern void DHT_Init(void); //Initialize the sensor
-extern void DHT_Humidity(uint16_t *Hum); //Save the humidity to a pointer
-extern void DHT_Temperature(int16_t *Temp); //Save the temperature to a pointer
-extern void DHT_GetMeteoData(int16_t *Temper, uint16_t *Humd); //Save both humidity and temp to the provided pointers
+extern uint8_t DHT_Humidity(uint16_t *Hum); //Save the humidity to a pointer, returns the status of the reading
+extern uint8_t DHT_Temperature(int16_t *Temp); //Save the temperature to a pointer, returns the status of the reading
+extern uint8_t DHT_GetMeteoData(int16_t *Temper, uint16_t *Humd); //Save both humidity and temp to the provided pointers, returns the status of the reading
+#if DHT_CACHE_ENABLE
+extern uint32_t DHT_Get_Age(void); //Time in ms since the last correct reading, 0xFFFFFFFF if there is none
+#ifndef DHT_TIME_MS
+extern void DHT_Tick(uint8_t ms); //Advance the time of the cache, call it from a timer interrupt
+#endif
+#endif
+#if DHT_STATS_ENABLE
+extern void DHT_Get_Stats(uint8_t pin, DHT_Stats *stats); //Copy the counters of the sensor at PIN bit (pin), DHT_PIN_NUM for the single sensor
+extern void DHT_Clear_Stats(void); //Reset the counters of all the sensors
+#endif
+#if DHT_MULTI_ENABLE
+extern uint8_t DHT_Read_Multi(uint8_t pin_mask, DHT_Reading *readings); //Read all the sensors of the pin mask at once, returns the mask of the correct readings
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+/*
+* Hardware abstraction layer of the libraries, for the registers, the delays, the interrupts and the flash and EEPROM access
+* On the AVR MCUs it is just the avr-libc headers, so the code is exactly the same as without it
+* On any other target the host backend of the Host folder is used, which simulates the registers, the time and the attached devices on a PC
+*/
+
+#if defined(__AVR__)
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+
+#define HAL_Idle() //Called in the loops that wait for a variable changed by an interrupt, nothing to do on the MCU
+#else
+#include "Host/Host.h"
+#endif
+
+#endif
@@ -0,0 +1,570 @@
+#include "Host.h"
+
+/*
+* Simulation of the ATmega644p parts that the libraries use
+* Everything runs on the calling thread, the clock moves only when the code accesses a register, waits in a delay or idles
+* The events that fall inside such a step, the end of a TWI operation, a Timer2 compare match and an edge at the ICP1 PIN, are handled at their own cycle
+*/
+
+//Interrupt routines, defined by the libraries with ISR() only when they are used
+extern "C" void TIMER2_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_CAPT_vect(void) __attribute__((weak));
+extern "C" void TWI_vect(void) __attribute__((weak));
+
+//Internal function prototypes
+void Host_Advance(uint64_t cycles, uint8_t blocked);
+void Host_Events(void);
+void Host_Dispatch(void);
+uint8_t Host_Read_Pins(uint8_t port);
+void Host_Port_Write(uint16_t address, uint8_t value);
+void Host_Timer1_Sync(void);
+void Host_Timer2_Sync(void);
+void Host_ICP_Check(void);
+void Host_TWI_Control(uint8_t value);
+void Host_TWI_Done(void);
+
+#define HOST_PORTS 4 //PORTS A to D
+#define HOST_ICP_PORT HOST_PORT_D //ICP1 is PD6
+#define HOST_ICP_BIT 6
+#define HOST_SREG_I 7 //The global interrupt enable bit
+#define HOST_TWI_PORT HOST_PORT_C //SCL is PC0 and SDA is PC1, both with pull-up resistors on the bus
+#define HOST_TWI_SCL_BIT 0
+#define HOST_TWI_SDA_BIT 1
+
+Host_Stats host_stats;
+
+uint8_t host_io[0x100]; //The register file, by data memory address
+uint8_t host_in_isr = 0; //Set while an interrupt routine runs, the interrupts don't nest
+
+Host_Pin_Device *host_pins[HOST_PORTS][8]; //The device on each PIN
+Host_Pin_Device *host_pin_devices[16]; //Every device on the PINS once, to tell them about the changes
+uint8_t host_pin_device_count = 0;
+Host_TWI_Device *host_twi_devices[8]; //The devices on the TWI bus
+uint8_t host_twi_device_count = 0;
+
+//Timer1, free running with the input capture unit
+uint64_t host_t1_base_cycle = 0; //The cycle at which the counter had host_t1_base_count
+uint16_t host_t1_base_count = 0;
+uint8_t host_icp_level = 1; //The last level of the ICP1 PIN
+
+//Timer2, in CTC mode with OCR2A as the top
+uint64_t host_t2_base_cycle = 0;
+uint8_t host_t2_base_count = 0;
+uint64_t host_t2_match = HOST_NEVER; //The cycle of the next compare match
+
+//TWI unit
+#define HOST_TWI_IDLE 0 //The bus is free
+#define HOST_TWI_ADDRESS 1 //A start was sent, the next byte is the address
+#define HOST_TWI_TRANSMIT 2 //The slave was addressed for writing
+#define HOST_TWI_RECEIVE 3 //The slave was addressed for reading
+
+uint8_t host_twi_state = HOST_TWI_IDLE;
+Host_TWI_Device *host_twi_slave = 0; //The addressed slave, 0 if no slave acknowledged
+uint64_t host_twi_done = HOST_NEVER; //The cycle at which the running operation ends and TWINT is set
+uint64_t host_twi_free = 0; //The cycle at which the bus finishes everything it was told to do
+uint64_t host_twi_stop_end = 0; //The cycle at which the last stop condition is sent and TWSTO is cleared
+uint8_t host_twi_status = 0xF8; //The status that TWSR shows, set when the operation ends
+uint8_t host_twi_next_status = 0xF8; //The status of the running operation
+uint8_t host_twi_next_data = 0; //The byte that TWDR gets when a read ends
+uint8_t host_twi_hold = 0; //SCL rising edges until the stuck slave releases SDA, 0 when the bus is free
+
+/*
+* Prescaler of a timer from its clock select bits, 0 when the timer is stopped
+*/
+const uint16_t host_t1_prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0}; //The external clock is not simulated
+const uint16_t host_t2_prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+void Host_Reset(void)
+{
+	memset(host_io, 0, sizeof(host_io));
+	memset(&host_stats, 0, sizeof(host_stats));
+	host_in_isr = 0;
+	host_t1_base_cycle = 0;
+	host_t1_base_count = 0;
+	host_icp_level = Host_Line_Level(HOST_ICP_PORT, HOST_ICP_BIT);
+	host_t2_base_cycle = 0;
+	host_t2_base_count = 0;
+	host_t2_match = HOST_NEVER;
+	host_twi_state = HOST_TWI_IDLE;
+	host_twi_slave = 0;
+	host_twi_done = HOST_NEVER;
+	host_twi_free = 0;
+	host_twi_stop_end = 0;
+	host_twi_status = 0xF8; //No state information
+	host_twi_hold = 0;
+}
+
+void Host_TWI_Hold(uint8_t clocks)
+{
+	host_twi_hold = clocks;
+	host_twi_done = HOST_NEVER; //The running operation doesn't end either
+}
+
+uint64_t Host_Cycles(void)
+{
+	return host_stats.cycles;
+}
+
+void Host_Attach_Pin(Host_Pin_Device *device, uint8_t port, uint8_t bit)
+{
+	uint8_t i = 0;
+
+	host_pins[port][bit] = device;
+	while ((i < host_pin_device_count) && (host_pin_devices[i] != device))
+		i++;
+	if ((i == host_pin_device_count) && (host_pin_device_count < 16))
+		host_pin_devices[host_pin_device_count++] = device;
+	if ((port == HOST_ICP_PORT) && (bit == HOST_ICP_BIT))
+		host_icp_level = Host_Line_Level(port, bit);
+}
+
+void Host_Attach_TWI(Host_TWI_Device *device)
+{
+	if (host_twi_device_count < 8)
+		host_twi_devices[host_twi_device_count++] = device;
+}
+
+void Host_Detach_All(void)
+{
+	memset(host_pins, 0, sizeof(host_pins));
+	host_pin_device_count = 0;
+	host_twi_device_count = 0;
+}
+
+int8_t Host_MCU_Level(uint8_t port, uint8_t bit)
+{
+	uint8_t address = 0x20 + 3*port;
+
+	if (host_io[address + 1] & (1 << bit)) //DDR
+		return ((host_io[address + 2] >> bit) & 1); //PORT
+	return -1;
+}
+
+uint8_t Host_Line_Level(uint8_t port, uint8_t bit)
+{
+	int8_t level = Host_MCU_Level(port, bit);
+
+	if (level >= 0)
+		return level;
+	if (host_pins[port][bit] && ((level = host_pins[port][bit]->Level(port, bit)) >= 0))
+		return level;
+	if ((port == HOST_TWI_PORT) && ((bit == HOST_TWI_SCL_BIT) || (bit == HOST_TWI_SDA_BIT))) //The pull-up resistors of the bus, unless a stuck slave holds SDA
+		return !(host_twi_hold && (bit == HOST_TWI_SDA_BIT));
+	return ((host_io[0x22 + 3*port] >> bit) & 1); //The pull-up resistor, else the line is taken as LOW
+}
+
+/*
+* The value of a PIN register, made from the levels of the lines
+*/
+uint8_t Host_Read_Pins(uint8_t port)
+{
+	uint8_t value = 0;
+
+	for (uint8_t bit = 0; bit < 8; bit++)
+		value |= Host_Line_Level(port, bit) << bit;
+	return value;
+}
+
+/*
+* Move the clock forward by (cycles), handling every event on the way
+* An interrupt that runs in between makes the step longer, like it makes a delay loop of the MCU longer
+*/
+void Host_Advance(uint64_t cycles, uint8_t blocked)
+{
+	uint64_t target = host_stats.cycles + cycles, next = 0, start = 0;
+
+	for (;;)
+	{
+		next = target;
+		if (host_twi_done < next)
+			next = host_twi_done;
+		if (host_t2_match < next)
+			next = host_t2_match;
+		if (host_pins[HOST_ICP_PORT][HOST_ICP_BIT] && host_t1_prescalers[host_io[0x81] & 0x07])
+		{
+			uint64_t edge = host_pins[HOST_ICP_PORT][HOST_ICP_BIT]->Next_Change(HOST_ICP_PORT, HOST_ICP_BIT);
+			if ((edge > host_stats.cycles) && (edge < next))
+				next = edge;
+		}
+
+		if (blocked)
+			host_stats.blocked_cycles += next - host_stats.cycles;
+		host_stats.cycles = next;
+		Host_Events();
+
+		start = host_stats.cycles;
+		Host_Dispatch();
+		target += host_stats.cycles - start;
+		if (host_stats.cycles >= target)
+			break;
+	}
+}
+
+/*
+* Handle the events that are due at the current cycle
+*/
+void Host_Events(void)
+{
+	if (host_stats.cycles >= host_twi_done)
+		Host_TWI_Done();
+	while ((host_stats.cycles >= host_t2_match) && host_t2_prescalers[host_io[0xB1] & 0x07])
+	{
+		host_io[0x37] |= (1 << OCF2A); //TIFR2
+		host_t2_base_cycle = host_t2_match;
+		host_t2_base_count = 0;
+		host_t2_match += (uint64_t)(host_io[0xB3] + 1) * host_t2_prescalers[host_io[0xB1] & 0x07]; //OCR2A and TCCR2B
+	}
+	Host_ICP_Check();
+}
+
+/*
+* Call the routines of the pending interrupts, in the priority order of the vectors
+*/
+void Host_Dispatch(void)
+{
+	void (*routine)(void);
+
+	while (!host_in_isr && (host_io[0x5F] & (1 << HOST_SREG_I)))
+	{
+		routine = 0;
+		if ((host_io[0x70] & (1 << OCIE2A)) && (host_io[0x37] & (1 << OCF2A))) //TIMER2_COMPA
+		{
+			host_io[0x37] &= ~(1 << OCF2A);
+			routine = TIMER2_COMPA_vect;
+		}
+		else if ((host_io[0x6F] & (1 << ICIE1)) && (host_io[0x36] & (1 << ICF1))) //TIMER1_CAPT
+		{
+			host_io[0x36] &= ~(1 << ICF1);
+			routine = TIMER1_CAPT_vect;
+		}
+		else if ((host_io[0xBC] & (1 << TWIE)) && (host_io[0xBC] & (1 << TWINT)) && TWI_vect) //TWI, the flag stays until the routine clears it
+			routine = TWI_vect;
+		if (!routine) //Nothing pending, or no routine for it
+			return;
+
+		host_in_isr = 1;
+		host_io[0x5F] &= ~(1 << HOST_SREG_I);
+		host_stats.interrupts++;
+		Host_Advance(HOST_ISR_CYCLES / 2, 0);
+		routine();
+		Host_Advance(HOST_ISR_CYCLES - HOST_ISR_CYCLES / 2, 0);
+		host_io[0x5F] |= (1 << HOST_SREG_I); //RETI
+		host_in_isr = 0;
+	}
+}
+
+/*
+* Find an edge at the ICP1 PIN and capture Timer1 if it is the selected edge
+*/
+void Host_ICP_Check(void)
+{
+	uint8_t level = Host_Line_Level(HOST_ICP_PORT, HOST_ICP_BIT);
+
+	if (level == host_icp_level)
+		return;
+	host_icp_level = level;
+	if (!host_t1_prescalers[host_io[0x81] & 0x07]) //Timer1 is stopped
+		return;
+	if (level == ((host_io[0x81] >> ICES1) & 1)) //Rising edge with ICES1 set, falling edge without it
+	{
+		Host_Timer1_Sync();
+		host_io[0x86] = host_t1_base_count & 0xFF; //ICR1
+		host_io[0x87] = host_t1_base_count >> 8;
+		host_io[0x36] |= (1 << ICF1);
+	}
+}
+
+/*
+* Bring the counter of Timer1 to the current cycle
+*/
+void Host_Timer1_Sync(void)
+{
+	uint16_t prescaler = host_t1_prescalers[host_io[0x81] & 0x07];
+	uint64_t ticks = 0;
+
+	if (prescaler)
+	{
+		ticks = (host_stats.cycles - host_t1_base_cycle) / prescaler;
+		host_t1_base_count += (uint16_t)ticks;
+		host_t1_base_cycle += ticks * prescaler;
+	}
+	else
+		host_t1_base_cycle = host_stats.cycles;
+}
+
+/*
+* Bring the counter of Timer2 to the current cycle and find its next compare match
+*/
+void Host_Timer2_Sync(void)
+{
+	uint16_t prescaler = host_t2_prescalers[host_io[0xB1] & 0x07];
+	uint64_t ticks = 0;
+
+	if (prescaler)
+	{
+		ticks = (host_stats.cycles - host_t2_base_cycle) / prescaler;
+		host_t2_base_count += (uint8_t)ticks;
+		host_t2_base_cycle += ticks * prescaler;
+	}
+	else
+		host_t2_base_cycle = host_stats.cycles;
+	host_io[0xB2] = host_t2_base_count; //TCNT2
+
+	if (prescaler && (host_io[0xB0] & (1 << WGM21)) && (host_t2_base_count <= host_io[0xB3])) //CTC mode, the counter is before OCR2A
+		host_t2_match = host_t2_base_cycle + (uint64_t)(host_io[0xB3] - host_t2_base_count + 1) * prescaler;
+	else
+		host_t2_match = HOST_NEVER;
+}
+
+uint8_t Host_Read(uint16_t address)
+{
+	uint8_t value = 0;
+
+	Host_Advance(HOST_ACCESS_CYCLES, (address == 0xBC) && ((host_twi_done != HOST_NEVER) || (host_twi_stop_end > host_stats.cycles) || host_twi_hold)); //Polling the busy or stuck TWI unit is blocked time
+	switch (address)
+	{
+		case 0x20: case 0x23: case 0x26: case 0x29: //PINx
+			return Host_Read_Pins((address - 0x20) / 3);
+		case 0x84: //TCNT1L, the high byte is latched for the next read
+			Host_Timer1_Sync();
+			host_io[0x85] = host_t1_base_count >> 8;
+			return host_t1_base_count & 0xFF;
+		case 0xB2: //TCNT2
+			Host_Timer2_Sync();
+			return host_io[0xB2];
+		case 0xB9: //TWSR
+			return (host_io[0xB9] & 0x03) | host_twi_status;
+		case 0xBC: //TWCR, TWSTO is set until the stop condition is sent
+			value = host_io[0xBC];
+			if (host_twi_stop_end > host_stats.cycles)
+				value |= (1 << TWSTO);
+			return value;
+		default:
+			return host_io[address];
+	}
+}
+
+uint16_t Host_Read16(uint16_t address)
+{
+	uint8_t low = Host_Read(address);
+
+	return ((uint16_t)Host_Read(address + 1) << 8) | low;
+}
+
+void Host_Write16(uint16_t address, uint16_t value)
+{
+	Host_Write(address + 1, value >> 8);
+	Host_Write(address, value & 0xFF);
+}
+
+void Host_Write(uint16_t address, uint8_t value)
+{
+	Host_Advance(HOST_ACCESS_CYCLES, 0);
+	switch (address)
+	{
+		case 0x21: case 0x22: case 0x24: case 0x25: case 0x27: case 0x28: case 0x2A: case 0x2B: //DDRx and PORTx
+			Host_Port_Write(address, value);
+			break;
+		case 0x36: case 0x37: //TIFRx, a flag is cleared by writing one to it
+			host_io[address] &= ~value;
+			break;
+		case 0x81: //TCCR1B, the counter runs on with the new clock
+			Host_Timer1_Sync();
+			host_io[address] = value;
+			break;
+		case 0x84: //TCNT1L, with the high byte written before it
+			host_io[address] = value;
+			host_t1_base_count = ((uint16_t)host_io[0x85] << 8) | value;
+			host_t1_base_cycle = host_stats.cycles;
+			break;
+		case 0xB0: case 0xB1: case 0xB3: //TCCR2A, TCCR2B and OCR2A
+			Host_Timer2_Sync();
+			host_io[address] = value;
+			Host_Timer2_Sync();
+			break;
+		case 0xB2: //TCNT2
+			host_io[address] = value;
+			host_t2_base_count = value;
+			host_t2_base_cycle = host_stats.cycles;
+			Host_Timer2_Sync();
+			break;
+		case 0xB9: //TWSR, only the prescaler bits can be written
+			host_io[address] = value & 0x03;
+			break;
+		case 0xBC: //TWCR
+			Host_TWI_Control(value);
+			break;
+		default:
+			host_io[address] = value;
+			break;
+	}
+	Host_Dispatch(); //Writing SREG, a mask or a control register can let a pending interrupt run
+}
+
+/*
+* Write a DDR or PORT register, count the changes of the PINS the MCU drives and let the devices see them
+*/
+void Host_Port_Write(uint16_t address, uint8_t value)
+{
+	uint8_t port = (address - 0x20) / 3, before[8], changed = 0, scl = Host_Line_Level(HOST_TWI_PORT, HOST_TWI_SCL_BIT);
+
+	for (uint8_t bit = 0; bit < 8; bit++)
+		before[bit] = Host_MCU_Level(port, bit);
+	host_io[address] = value;
+	for (uint8_t bit = 0; bit < 8; bit++)
+		if ((int8_t)before[bit] != Host_MCU_Level(port, bit))
+			changed++;
+	host_stats.gpio_toggles += changed;
+	if (host_twi_hold && !scl && Host_Line_Level(HOST_TWI_PORT, HOST_TWI_SCL_BIT)) //A rising edge of SCL, driven by hand, moves the stuck slave to its next bit
+		host_twi_hold--;
+
+	if (!changed)
+		return;
+	for (uint8_t i = 0; i < host_pin_device_count; i++)
+		host_pin_devices[i]->Pins_Changed();
+	Host_ICP_Check();
+}
+
+/*
+* Period of the SCL clock in CPU cycles, from TWBR and the prescaler
+*/
+uint64_t Host_TWI_Bit(void)
+{
+	return 16 + 2 * (uint64_t)host_io[0xB8] * (1 << (2 * (host_io[0xB9] & 0x03)));
+}
+
+/*
+* A write to TWCR, which starts a bus operation when TWINT is written to one
+* The operation takes the time of its bits on the bus and sets TWINT at its end
+*/
+void Host_TWI_Control(uint8_t value)
+{
+	uint64_t start = (host_twi_free > host_stats.cycles) ? host_twi_free : host_stats.cycles, length = 0;
+
+	host_io[0xBC] = (host_io[0xBC] & (1 << TWINT)) | (value & ~((1 << TWINT) | (1 << TWSTO))); //Only the hardware sets TWINT
+	if (!(value & (1 << TWEN))) //The TWI unit is turned off, the bus is released
+	{
+		host_io[0xBC] &= ~(1 << TWINT);
+		host_twi_state = HOST_TWI_IDLE;
+		host_twi_done = HOST_NEVER;
+		host_twi_free = host_stats.cycles;
+		host_twi_stop_end = 0;
+		return;
+	}
+	if (!(value & (1 << TWINT))) //Only the control bits changed
+		return;
+	host_io[0xBC] &= ~(1 << TWINT);
+	if (host_twi_hold) //SDA is held LOW, so the operation never ends
+	{
+		host_twi_done = HOST_NEVER;
+		if (value & (1 << TWSTO))
+			host_twi_stop_end = HOST_NEVER;
+		return;
+	}
+
+	if (value & (1 << TWSTO)) //Stop condition
+	{
+		if (host_twi_slave)
+			host_twi_slave->Stop();
+		host_twi_slave = 0;
+		host_twi_state = HOST_TWI_IDLE;
+		length += Host_TWI_Bit();
+		host_twi_stop_end = start + length;
+	}
+	if (value & (1 << TWSTA)) //Start or repeated start condition
+	{
+		if (host_twi_state == HOST_TWI_IDLE)
+		{
+			host_twi_next_status = 0x08;
+			host_stats.twi_transactions++;
+		}
+		else
+			host_twi_next_status = 0x10;
+		host_twi_slave = 0;
+		host_twi_state = HOST_TWI_ADDRESS;
+		length += Host_TWI_Bit();
+	}
+	else if (!(value & (1 << TWSTO)))
+	{
+		uint8_t data = host_io[0xBB]; //TWDR
+
+		length += 9 * Host_TWI_Bit(); //Eight bits and the acknowledge
+		host_stats.twi_bytes++;
+		switch (host_twi_state)
+		{
+			case HOST_TWI_ADDRESS:
+				host_twi_slave = 0;
+				for (uint8_t i = 0; i < host_twi_device_count; i++)
+					if (host_twi_devices[i]->address == (data >> 1))
+						host_twi_slave = host_twi_devices[i];
+				if (host_twi_slave)
+				{
+					if (F_CPU / Host_TWI_Bit() > host_twi_slave->max_freq)
+						host_twi_slave->speed_violations++;
+					host_twi_slave->Start(data & 1);
+				}
+				if (data & 1)
+				{
+					host_twi_next_status = host_twi_slave ? 0x40 : 0x48;
+					host_twi_state = HOST_TWI_RECEIVE;
+				}
+				else
+				{
+					host_twi_next_status = host_twi_slave ? 0x18 : 0x20;
+					host_twi_state = HOST_TWI_TRANSMIT;
+				}
+				break;
+			case HOST_TWI_TRANSMIT:
+				host_twi_next_status = (host_twi_slave && host_twi_slave->Write(data)) ? 0x28 : 0x30;
+				break;
+			case HOST_TWI_RECEIVE:
+				host_twi_next_data = host_twi_slave ? host_twi_slave->Read() : 0xFF;
+				host_twi_next_status = (value & (1 << TWEA)) ? 0x50 : 0x58;
+				break;
+			default: //No start condition before the byte
+				host_stats.twi_bytes--;
+				host_twi_next_status = 0x00; //Bus error
+				length = 0;
+				break;
+		}
+	}
+
+	host_stats.twi_bus_cycles += length;
+	host_twi_free = start + length;
+	if ((value & (1 << TWSTO)) && !(value & (1 << TWSTA))) //A stop alone doesn't set TWINT
+		host_twi_done = HOST_NEVER;
+	else
+		host_twi_done = host_twi_free;
+}
+
+/*
+* The running TWI operation has ended
+*/
+void Host_TWI_Done(void)
+{
+	host_twi_done = HOST_NEVER;
+	host_twi_status = host_twi_next_status;
+	if (host_twi_state == HOST_TWI_RECEIVE && (host_twi_status == 0x50 || host_twi_status == 0x58))
+		host_io[0xBB] = host_twi_next_data;
+	host_io[0xBC] |= (1 << TWINT);
+}
+
+void Host_Delay(uint64_t cycles)
+{
+	Host_Advance(cycles, 1);
+}
+
+void Host_Idle(void)
+{
+	Host_Advance(HOST_ACCESS_CYCLES, 1);
+}
+
+void Host_Sei(void)
+{
+	Host_Write(0x5F, host_io[0x5F] | (1 << HOST_SREG_I));
+}
+
+void Host_Cli(void)
+{
+	Host_Write(0x5F, host_io[0x5F] & ~(1 << HOST_SREG_I));
+}
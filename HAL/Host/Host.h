@@ -0,0 +1,240 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+/*
+* Host backend of the HAL, it lets the libraries build with g++ and run on a PC
+* The registers of the ATmega644p are kept in a simulated register file and every access goes through Host_Read() and Host_Write()
+* Time is counted in CPU cycles, by the _delay_ functions and by each register access, so every run gives exactly the same timing
+* The TWI unit, Timer1 with its input capture unit and Timer2 in CTC mode are simulated, with their interrupts
+* The devices on the PINS and on the TWI bus are C++ objects, see Models.h
+*/
+
+#ifndef __cplusplus
+#error "The host backend of the HAL needs a C++ compiler, build the libraries with g++"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#define HOST_ACCESS_CYCLES 4 //CPU cycles counted for each register access, for the access and the few instructions around it
+#define HOST_ISR_CYCLES 10 //CPU cycles counted for entering and leaving an interrupt
+#define HOST_NEVER UINT64_MAX //Time of an event that never happens
+
+#define HOST_US_TO_CYCLES(us) ((uint64_t)((us) * (F_CPU / 1000000.0) + 0.5)) //Convert micro seconds to CPU cycles
+#define HOST_CYCLES_TO_US(cycles) ((double)(cycles) / (F_CPU / 1000000.0)) //Convert CPU cycles to micro seconds
+
+extern uint8_t Host_Read(uint16_t address); //Read a register, the clock moves by HOST_ACCESS_CYCLES
+extern void Host_Write(uint16_t address, uint8_t value); //Write a register, the clock moves by HOST_ACCESS_CYCLES
+extern uint16_t Host_Read16(uint16_t address); //Read a 16-bit register, low byte first
+extern void Host_Write16(uint16_t address, uint16_t value); //Write a 16-bit register, high byte first
+extern void Host_Delay(uint64_t cycles); //Let the time pass, counted as blocked time
+extern void Host_Idle(void); //Wait a little in a loop that waits for an interrupt, counted as blocked time
+extern void Host_Sei(void); //Enable the interrupts
+extern void Host_Cli(void); //Disable the interrupts
+
+/*
+* An 8-bit register, which is read and written through the simulation
+* The register names are temporary objects of this class, so PORTD |= (1 << 2) is a read and a write of the register
+*/
+class Host_Reg
+{
+public:
+	explicit Host_Reg(uint16_t address) : address(address) {}
+	operator uint8_t() const { return Host_Read(address); }
+	Host_Reg &operator=(int value) { Host_Write(address, (uint8_t)value); return *this; } //The values are int, like the expressions of the libraries, and only the low byte is kept
+	Host_Reg &operator=(const Host_Reg &reg) { Host_Write(address, (uint8_t)reg); return *this; }
+	Host_Reg &operator|=(int value) { Host_Write(address, (uint8_t)(Host_Read(address) | value)); return *this; }
+	Host_Reg &operator&=(int value) { Host_Write(address, (uint8_t)(Host_Read(address) & value)); return *this; }
+	Host_Reg &operator^=(int value) { Host_Write(address, (uint8_t)(Host_Read(address) ^ value)); return *this; }
+
+	uint16_t address; //Data memory address of the register
+};
+
+/*
+* A 16-bit register of Timer1
+*/
+class Host_Reg16
+{
+public:
+	explicit Host_Reg16(uint16_t address) : address(address) {}
+	operator uint16_t() const { return Host_Read16(address); }
+	Host_Reg16 &operator=(uint16_t value) { Host_Write16(address, value); return *this; }
+	Host_Reg16 &operator=(const Host_Reg16 &reg) { Host_Write16(address, (uint16_t)reg); return *this; }
+
+	uint16_t address;
+};
+
+//The registers used by the libraries, at their data memory addresses of the ATmega644p
+#define PINA Host_Reg(0x20)
+#define DDRA Host_Reg(0x21)
+#define PORTA Host_Reg(0x22)
+#define PINB Host_Reg(0x23)
+#define DDRB Host_Reg(0x24)
+#define PORTB Host_Reg(0x25)
+#define PINC Host_Reg(0x26)
+#define DDRC Host_Reg(0x27)
+#define PORTC Host_Reg(0x28)
+#define PIND Host_Reg(0x29)
+#define DDRD Host_Reg(0x2A)
+#define PORTD Host_Reg(0x2B)
+#define TIFR1 Host_Reg(0x36)
+#define TIFR2 Host_Reg(0x37)
+#define SREG Host_Reg(0x5F)
+#define TIMSK1 Host_Reg(0x6F)
+#define TIMSK2 Host_Reg(0x70)
+#define TCCR1A Host_Reg(0x80)
+#define TCCR1B Host_Reg(0x81)
+#define TCNT1 Host_Reg16(0x84)
+#define ICR1 Host_Reg16(0x86)
+#define TCCR2A Host_Reg(0xB0)
+#define TCCR2B Host_Reg(0xB1)
+#define TCNT2 Host_Reg(0xB2)
+#define OCR2A Host_Reg(0xB3)
+#define TWBR Host_Reg(0xB8)
+#define TWSR Host_Reg(0xB9)
+#define TWAR Host_Reg(0xBA)
+#define TWDR Host_Reg(0xBB)
+#define TWCR Host_Reg(0xBC)
+
+//Register bits
+#define TOV1 0
+#define ICF1 5
+#define OCF2A 1
+#define TOIE1 0
+#define ICIE1 5
+#define OCIE2A 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define ICES1 6
+#define ICNC1 7
+#define WGM20 0
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define TWPS0 0
+#define TWPS1 1
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+
+//Delays, they take the time of the MCU without any real waiting
+inline void _delay_us(double us) { Host_Delay(HOST_US_TO_CYCLES(us)); }
+inline void _delay_ms(double ms) { Host_Delay(HOST_US_TO_CYCLES(ms * 1000.0)); }
+
+//Interrupts, the simulation calls the routines when their flags are set and the interrupts are enabled
+#define sei() Host_Sei()
+#define cli() Host_Cli()
+#define ISR(vector) extern "C" void vector(void)
+
+/*
+* Disables the interrupts for the block and restores SREG after it, like the ATOMIC_BLOCK of avr-libc
+*/
+class Host_Atomic
+{
+public:
+	Host_Atomic() : sreg(SREG), once(1) { cli(); }
+	~Host_Atomic() { SREG = sreg; }
+	uint8_t Once(void) { return once ? once-- : 0; }
+
+	uint8_t sreg, once;
+};
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1 //Restores SREG as it was, which is the same if the interrupts were enabled
+#define ATOMIC_BLOCK(type) for (Host_Atomic host_atomic; host_atomic.Once(); )
+
+#define HAL_Idle() Host_Idle()
+
+//Flash memory, the tables are plain constants on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(str) (str)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+//EEPROM, the variables stay in the RAM of the host, so their contents last until the program ends
+#define EEMEM
+inline void eeprom_read_block(void *dst, const void *src, size_t size) { memcpy(dst, src, size); }
+inline void eeprom_update_block(const void *src, void *dst, size_t size) { memcpy(dst, src, size); }
+inline uint8_t eeprom_read_byte(const uint8_t *address) { return *address; }
+inline void eeprom_update_byte(uint8_t *address, uint8_t value) { *address = value; }
+
+/*
+* Simulation control, used by the programs that run the libraries on the host
+*/
+typedef struct
+{
+	uint64_t cycles; //CPU cycles since the last Host_Reset()
+	uint64_t blocked_cycles; //Cycles spent in the _delay_ functions, polling the busy TWI unit and waiting for the interrupts
+	uint64_t twi_bus_cycles; //Cycles that the TWI bus was sending conditions or bytes
+	uint32_t twi_bytes; //Address and data bytes on the TWI bus
+	uint32_t twi_transactions; //Start conditions on a free bus, the repeated starts are not counted
+	uint32_t gpio_toggles; //Changes of the PINS that the MCU drives, from LOW to HIGH, HIGH to LOW or output to input
+	uint32_t interrupts; //Interrupt routines that were called
+} Host_Stats;
+
+extern Host_Stats host_stats;
+
+extern void Host_Reset(void); //Reset the registers, the clock and the statistics, the attached devices stay
+extern uint64_t Host_Cycles(void); //The CPU cycles since the last Host_Reset()
+extern void Host_TWI_Hold(uint8_t clocks); //A slave holds SDA LOW until SCL rises (clocks) times, so the TWI unit can't finish its operations
+
+//The PORTS by number, HOST_PIN(D, 2) gives the number and the bit of a PIN, from the same descriptors the libraries use
+#define HOST_PORT_A 0
+#define HOST_PORT_B 1
+#define HOST_PORT_C 2
+#define HOST_PORT_D 3
+#define HOST_PIN(...) HOST_PIN_(__VA_ARGS__)
+#define HOST_PIN_(port, bit) HOST_PORT_##port, (bit)
+
+/*
+* A device connected to PINS of the MCU
+*/
+class Host_Pin_Device
+{
+public:
+	virtual ~Host_Pin_Device() {}
+	virtual int8_t Level(uint8_t port, uint8_t bit) = 0; //The level it drives on the PIN now, 0 or 1, or -1 if it doesn't drive it
+	virtual uint64_t Next_Change(uint8_t port, uint8_t bit) { (void)port; (void)bit; return HOST_NEVER; } //The cycle of the next change of the level it drives
+	virtual void Pins_Changed(void) {} //Called after the MCU wrote a PORT or DDR register
+};
+
+/*
+* A slave device on the TWI bus
+*/
+class Host_TWI_Device
+{
+public:
+	explicit Host_TWI_Device(uint8_t address, uint32_t max_freq = 400000) : address(address), max_freq(max_freq), speed_violations(0) {}
+	virtual ~Host_TWI_Device() {}
+	virtual void Start(uint8_t read) { (void)read; } //Addressed after a start condition, with the read bit (read)
+	virtual uint8_t Write(uint8_t data) { (void)data; return 1; } //A byte from the master, returns 1 to acknowledge it
+	virtual uint8_t Read(void) { return 0xFF; } //The next byte for the master
+	virtual void Stop(void) {} //Stop condition
+
+	uint8_t address; //The 7-bit address
+	uint32_t max_freq; //The highest SCL frequency it works at
+	uint32_t speed_violations; //Times it was addressed with a faster SCL
+};
+
+extern void Host_Attach_Pin(Host_Pin_Device *device, uint8_t port, uint8_t bit); //Connect a device to a PIN, one device on each PIN
+extern void Host_Attach_TWI(Host_TWI_Device *device); //Connect a device to the TWI bus
+extern void Host_Detach_All(void); //Remove all the devices
+extern int8_t Host_MCU_Level(uint8_t port, uint8_t bit); //The level the MCU drives on a PIN, or -1 if the PIN is an input
+extern uint8_t Host_Line_Level(uint8_t port, uint8_t bit); //The level of the line, from the MCU, the device or the pull-up resistor
+
+#endif
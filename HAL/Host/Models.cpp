@@ -0,0 +1,429 @@
+#include "Models.h"
+
+/*
+* BMP180
+*/
+const int16_t host_bmp180_example[11] = {408, -72, -14383, 32741, 32757, 23153, 6190, 4, -32768, -8711, 2868}; //AC1 to MD of the data sheet example
+const uint16_t host_bmp180_press_us[4] = {4500, 7500, 13500, 25500}; //Pressure conversion time for each resolution
+
+Host_BMP180::Host_BMP180(uint8_t address) : Host_TWI_Device(address)
+{
+	Set_Calibration(host_bmp180_example);
+	ut = 27898;
+	up = 23843;
+	pointer = 0;
+	first_byte = 0;
+	control = 0;
+	memset(out, 0, sizeof(out));
+	done = HOST_NEVER;
+	conversions = 0;
+	early_reads = 0;
+}
+
+void Host_BMP180::Set_Calibration(const int16_t *values)
+{
+	for (uint8_t i = 0; i < 11; i++)
+	{
+		calibration[2*i] = (uint16_t)values[i] >> 8; //MSB first
+		calibration[2*i + 1] = (uint16_t)values[i] & 0xFF;
+	}
+}
+
+void Host_BMP180::Start(uint8_t read)
+{
+	if (!read)
+		first_byte = 1;
+}
+
+uint8_t Host_BMP180::Write(uint8_t data)
+{
+	if (first_byte) //The register address
+	{
+		pointer = data;
+		first_byte = 0;
+		return 1;
+	}
+	if (pointer == 0xF4) //A command starts a conversion, the SCO bit of the command stays set until it ends
+	{
+		Register(0xF4); //Finish the previous conversion first
+		control = data;
+		conversions++;
+		if (data == 0x2E)
+			done = Host_Cycles() + HOST_US_TO_CYCLES(4500);
+		else if ((data & 0x3F) == 0x34)
+			done = Host_Cycles() + HOST_US_TO_CYCLES(host_bmp180_press_us[data >> 6]);
+		else
+			conversions--;
+	}
+	pointer++;
+	return 1;
+}
+
+uint8_t Host_BMP180::Read(void)
+{
+	if ((pointer >= 0xF6) && (pointer <= 0xF8) && (done != HOST_NEVER) && (Host_Cycles() < done))
+		early_reads++;
+	return Register(pointer++);
+}
+
+uint8_t Host_BMP180::Register(uint8_t reg)
+{
+	if ((done != HOST_NEVER) && (Host_Cycles() >= done)) //The conversion has ended, so its result is in the registers now
+	{
+		done = HOST_NEVER;
+		if (control == 0x2E)
+		{
+			out[0] = ut >> 8;
+			out[1] = ut & 0xFF;
+			out[2] = 0;
+		}
+		else //The lowest resolution value with zeros at the extra bits, so the library gets up << PRESS_RESOLUTION
+		{
+			out[0] = up >> 8;
+			out[1] = up & 0xFF;
+			out[2] = 0;
+		}
+		control &= ~(1 << 5); //SCO
+	}
+	if ((reg >= 0xAA) && (reg <= 0xBF))
+		return calibration[reg - 0xAA];
+	if ((reg >= 0xF6) && (reg <= 0xF8))
+		return out[reg - 0xF6];
+	if (reg == 0xF4)
+		return control;
+	if (reg == 0xD0) //Chip id
+		return 0x55;
+	return 0;
+}
+
+/*
+* DHT22
+*/
+Host_DHT22::Host_DHT22()
+{
+	humidity = 452; //45.2%
+	temperature = 231; //23.1C
+	crc_error = 0;
+	present = 1;
+	port = 0;
+	bit = 0;
+	low = 0;
+	low_start = 0;
+	edge_count = 0;
+	frames = 0;
+}
+
+void Host_DHT22::Attach(uint8_t port, uint8_t bit)
+{
+	this->port = port;
+	this->bit = bit;
+	Host_Attach_Pin(this, port, bit);
+}
+
+/*
+* Watch the start pulse of the MCU and build the frame when the line is released
+*/
+void Host_DHT22::Pins_Changed(void)
+{
+	uint64_t now = Host_Cycles(), time = 0;
+	uint16_t values[2];
+	uint8_t frame[5];
+
+	if (Host_MCU_Level(port, bit) == 0)
+	{
+		if (!low)
+		{
+			low = 1;
+			low_start = now;
+			edge_count = 0; //A new start pulse stops the frame
+		}
+		return;
+	}
+	if (!low)
+		return;
+	low = 0;
+	if (!present || (now - low_start < HOST_US_TO_CYCLES(800)))
+		return;
+
+	values[0] = humidity;
+	values[1] = (temperature < 0) ? (0x8000 | -temperature) : temperature; //Sign and magnitude
+	frame[0] = values[0] >> 8;
+	frame[1] = values[0] & 0xFF;
+	frame[2] = values[1] >> 8;
+	frame[3] = values[1] & 0xFF;
+	frame[4] = frame[0] + frame[1] + frame[2] + frame[3] + (crc_error ? 1 : 0);
+	if (crc_error && (crc_error != HOST_DHT_ALWAYS))
+		crc_error--;
+
+	//The answer 30us after the release, 80us LOW and 80us HIGH, then each bit 50us LOW and 26us HIGH for zero or 70us for one, then 50us LOW
+	time = now + HOST_US_TO_CYCLES(30);
+	edge_count = 0;
+	edges[edge_count++] = time;
+	time += HOST_US_TO_CYCLES(80);
+	edges[edge_count++] = time;
+	time += HOST_US_TO_CYCLES(80);
+	for (uint8_t i = 0; i < 40; i++)
+	{
+		edges[edge_count++] = time;
+		time += HOST_US_TO_CYCLES(50);
+		edges[edge_count++] = time;
+		time += HOST_US_TO_CYCLES((frame[i >> 3] & (0x80 >> (i & 7))) ? 70 : 26);
+	}
+	edges[edge_count++] = time;
+	time += HOST_US_TO_CYCLES(50);
+	edges[edge_count++] = time;
+	frames++;
+}
+
+int8_t Host_DHT22::Level(uint8_t port, uint8_t bit)
+{
+	uint64_t now = Host_Cycles();
+	uint8_t count = 0;
+
+	(void)port;
+	(void)bit;
+	while ((count < edge_count) && (edges[count] <= now))
+		count++;
+	return (count & 1) ? 0 : 1; //LOW after the odd changes, else the pull-up resistor
+}
+
+uint64_t Host_DHT22::Next_Change(uint8_t port, uint8_t bit)
+{
+	uint64_t now = Host_Cycles();
+
+	(void)port;
+	(void)bit;
+	for (uint8_t i = 0; i < edge_count; i++)
+		if (edges[i] > now)
+			return edges[i];
+	return HOST_NEVER;
+}
+
+/*
+* HD44780
+*/
+Host_HD44780::Host_HD44780(uint8_t cols, uint8_t rows)
+{
+	this->cols = cols;
+	this->rows = rows;
+	memset(ddram, ' ', sizeof(ddram));
+	memset(cgram, 0, sizeof(cgram));
+	memset(pins, -1, sizeof(pins));
+	address = 0;
+	cgram_selected = 0;
+	increment = 1;
+	shift_on_write = 0;
+	shift = 0;
+	display_control = 0;
+	four_bit = 0; //The LCD starts in the 8-bit mode
+	nibble = 0;
+	upper = 0;
+	read_nibble = 0;
+	read_byte = 0;
+	e_last = 0;
+	reading = 0;
+	read_value = 0;
+	busy_until = 0;
+	instructions = 0;
+	writes = 0;
+	reads = 0;
+	violations = 0;
+}
+
+void Host_HD44780::Attach(uint8_t role, uint8_t port, uint8_t bit)
+{
+	pins[role][0] = port;
+	pins[role][1] = bit;
+	Host_Attach_Pin(this, port, bit);
+}
+
+/*
+* The LCD drives the data lines only while a read is strobed
+*/
+int8_t Host_HD44780::Level(uint8_t port, uint8_t bit)
+{
+	if (!reading)
+		return -1;
+	for (uint8_t role = 0; role < 8; role++)
+		if ((pins[role][0] == port) && (pins[role][1] == bit))
+			return (read_value >> role) & 1;
+	return -1;
+}
+
+void Host_HD44780::Pins_Changed(void)
+{
+	uint8_t level[11];
+
+	if (reading && (pins[HOST_LCD_RW][0] >= 0) && !Host_Line_Level(pins[HOST_LCD_RW][0], pins[HOST_LCD_RW][1]))
+		reading = 0; //R/W went LOW, the LCD stops driving the lines
+	for (uint8_t role = 0; role < 11; role++)
+		level[role] = (pins[role][0] >= 0) ? Host_Line_Level(pins[role][0], pins[role][1]) : 0; //A line that isn't connected is LOW
+	Lines(level[HOST_LCD_RS], level[HOST_LCD_RW], level[HOST_LCD_E], level[0] | (level[1] << 1) | (level[2] << 2) | (level[3] << 3)
+		| (level[4] << 4) | (level[5] << 5) | (level[6] << 6) | (level[7] << 7));
+}
+
+/*
+* The bytes are taken at the falling edge of Enable and a read is placed on the lines at its rising edge
+*/
+void Host_HD44780::Lines(uint8_t rs, uint8_t rw, uint8_t e, uint8_t data)
+{
+	if (e && !e_last && rw)
+	{
+		if (!four_bit || !read_nibble)
+		{
+			read_byte = ((Host_Cycles() < busy_until) ? 0x80 : 0) | (address & 0x7F); //Busy flag and address counter, a data read is not simulated
+			reads++;
+		}
+		read_value = (four_bit && read_nibble) ? (read_byte << 4) : read_byte;
+		reading = 1;
+	}
+	else if (!e && e_last)
+	{
+		if (reading || rw)
+		{
+			reading = 0;
+			if (four_bit)
+				read_nibble ^= 1;
+		}
+		else if (four_bit)
+		{
+			nibble ^= 1; //Before the byte, which clears it at a function set
+			if (nibble)
+				upper = data & 0xF0;
+			else
+				Byte(rs, upper | (data >> 4));
+		}
+		else
+			Byte(rs, data);
+	}
+	e_last = e;
+}
+
+void Host_HD44780::Move(int8_t step)
+{
+	uint8_t line = (address & 0x40) ? 1 : 0, place = (address & 0x3F) % 40;
+
+	if (cgram_selected)
+	{
+		address = (address + step) & 0x3F;
+		return;
+	}
+	if ((step > 0) && (++place == 40)) //From the end of a line to the start of the other
+	{
+		place = 0;
+		line ^= 1;
+	}
+	else if ((step < 0) && (place-- == 0))
+	{
+		place = 39;
+		line ^= 1;
+	}
+	address = (line << 6) | place;
+}
+
+void Host_HD44780::Byte(uint8_t rs, uint8_t value)
+{
+	uint64_t now = Host_Cycles();
+
+	if (now < busy_until) //The LCD ignores it
+	{
+		violations++;
+		return;
+	}
+	busy_until = now + HOST_US_TO_CYCLES(37);
+	if (rs)
+	{
+		if (cgram_selected)
+			cgram[address & 0x3F] = value;
+		else
+			ddram[(address & 0x40) ? 1 : 0][(address & 0x3F) % 40] = value;
+		Move(increment ? 1 : -1);
+		if (shift_on_write)
+			shift = increment ? (shift + 1) % 40 : (shift + 39) % 40;
+		busy_until += HOST_US_TO_CYCLES(4);
+		writes++;
+		return;
+	}
+
+	instructions++;
+	if (value & 0x80) //Set DDRAM address
+	{
+		address = value & 0x7F;
+		cgram_selected = 0;
+	}
+	else if (value & 0x40) //Set CGRAM address
+	{
+		address = value & 0x3F;
+		cgram_selected = 1;
+	}
+	else if (value & 0x20) //Function set
+	{
+		four_bit = !(value & 0x10);
+		nibble = 0;
+		read_nibble = 0;
+	}
+	else if (value & 0x10) //Cursor or display shift
+	{
+		if (value & 0x08) //The display moves to the left with R/L cleared, so the window moves to the right of the DDRAM
+			shift = (value & 0x04) ? (shift + 39) % 40 : (shift + 1) % 40;
+		else
+			Move((value & 0x04) ? 1 : -1);
+	}
+	else if (value & 0x08) //Display control
+		display_control = value;
+	else if (value & 0x04) //Entry mode set
+	{
+		increment = (value & 0x02) ? 1 : 0;
+		shift_on_write = value & 0x01;
+	}
+	else if (value & 0x02) //Return home
+	{
+		address = 0;
+		cgram_selected = 0;
+		shift = 0;
+		busy_until = now + HOST_US_TO_CYCLES(1520);
+	}
+	else if (value & 0x01) //Clear display
+	{
+		memset(ddram, ' ', sizeof(ddram));
+		address = 0;
+		cgram_selected = 0;
+		shift = 0;
+		increment = 1;
+		busy_until = now + HOST_US_TO_CYCLES(1520);
+	}
+}
+
+/*
+* Rows 0 and 1 start at the DDRAM lines and rows 2 and 3 continue them after the columns of the first two
+*/
+void Host_HD44780::Row(uint8_t row, char *text)
+{
+	uint8_t line = row & 1, offset = (row >> 1) * cols;
+
+	for (uint8_t col = 0; col < cols; col++)
+		text[col] = ddram[line][(offset + col + shift) % 40];
+	text[cols] = '\0';
+}
+
+/*
+* PCF8574
+*/
+Host_PCF8574::Host_PCF8574(Host_HD44780 *lcd, uint8_t address) : Host_TWI_Device(address, 100000) //The PCF8574 works only in the 100kHz Standard-mode
+{
+	this->lcd = lcd;
+	output = 0xFF; //The quasi bidirectional PINS start HIGH
+}
+
+uint8_t Host_PCF8574::Write(uint8_t data)
+{
+	output = data;
+	if (lcd)
+		lcd->Lines(data & 0x01, (data >> 1) & 0x01, (data >> 2) & 0x01, data & 0xF0);
+	return 1;
+}
+
+uint8_t Host_PCF8574::Read(void)
+{
+	return output;
+}
@@ -0,0 +1,126 @@
+#ifndef MODELS_H_
+#define MODELS_H_
+
+#include "Host.h"
+
+/*
+* Behavioural models of the devices that the libraries drive, for the host backend of the HAL
+* Each model is attached to the PINS or to the TWI bus of the simulated MCU and keeps counters of what it saw
+*/
+
+/*
+* BMP180 pressure sensor
+* The calibration EEPROM has the example values of the data sheet and the raw values give 15.0C and 69964Pa with the data sheet calculation
+* A conversion takes the time of the data sheet and the SCO bit is set until it ends, the result registers change only then
+*/
+class Host_BMP180 : public Host_TWI_Device
+{
+public:
+	Host_BMP180(uint8_t address = 0x77);
+	void Start(uint8_t read);
+	uint8_t Write(uint8_t data);
+	uint8_t Read(void);
+	void Set_Calibration(const int16_t *values); //The 11 calibration values, AC1 to MD, in the order of their registers
+	uint8_t Register(uint8_t reg); //The value of a register, as the master would read it now
+
+	uint8_t calibration[22]; //The calibration EEPROM, registers 0xAA to 0xBF
+	uint16_t ut; //The raw temperature value
+	uint16_t up; //The raw pressure value at the lowest resolution, it is given with (PRESS_RESOLUTION) more zero bits at the higher ones
+	uint8_t pointer; //The register address for the next read or write
+	uint8_t first_byte; //Set when the next written byte is the register address
+	uint8_t control; //The control register 0xF4, without the SCO bit
+	uint8_t out[3]; //The result registers 0xF6 to 0xF8
+	uint64_t done; //The cycle at which the running conversion ends, HOST_NEVER if none is running
+	uint32_t conversions; //Conversions started
+	uint32_t early_reads; //Reads of the result registers while a conversion was running
+};
+
+/*
+* DHT22 temperature and humidity sensor on one PIN
+* After a start pulse of at least 800us it answers when the line is released, with the timing of the data sheet
+* The line has a pull-up resistor, so the model drives it LOW or HIGH all the time
+*/
+#define HOST_DHT_ALWAYS 0xFF //Value of crc_error that never counts down
+
+class Host_DHT22 : public Host_Pin_Device
+{
+public:
+	Host_DHT22();
+	void Attach(uint8_t port, uint8_t bit); //Connect the sensor to a PIN, use HOST_PIN() with the descriptor of the library
+	int8_t Level(uint8_t port, uint8_t bit);
+	uint64_t Next_Change(uint8_t port, uint8_t bit);
+	void Pins_Changed(void);
+
+	int16_t humidity; //The humidity multiplied by 10
+	int16_t temperature; //The temperature multiplied by 10
+	uint8_t crc_error; //Number of the next frames to send with a wrong CRC, HOST_DHT_ALWAYS for all of them
+	uint8_t present; //Set to (0) to take the sensor away, so it never answers
+	uint8_t port, bit; //The PIN of the sensor
+	uint8_t low; //Set while the MCU pulls the line LOW
+	uint64_t low_start; //The cycle at which the MCU pulled the line LOW
+	uint64_t edges[84]; //The cycles at which the sensor changes the line, the first one goes LOW
+	uint8_t edge_count; //Number of changes of the frame, zero if no frame is sent
+	uint32_t frames; //Frames sent
+};
+
+/*
+* HD44780 LCD controller with 80 characters of DDRAM in two lines and 64 bytes of CGRAM
+* It takes the execution time of the data sheet for each instruction and ignores the ones written while it is busy, counting them as violations
+* It is attached to the PINS of a parallel interface with Attach(), or placed behind a Host_PCF8574
+*/
+#define HOST_LCD_RS 8 //Roles of the PINS for Attach(), 0 to 7 are D0 to D7
+#define HOST_LCD_RW 9
+#define HOST_LCD_E 10
+
+class Host_HD44780 : public Host_Pin_Device
+{
+public:
+	Host_HD44780(uint8_t cols = 20, uint8_t rows = 4);
+	void Attach(uint8_t role, uint8_t port, uint8_t bit); //Connect a line, D0 to D7 or one of the HOST_LCD_ roles, to a PIN
+	int8_t Level(uint8_t port, uint8_t bit);
+	void Pins_Changed(void);
+	void Lines(uint8_t rs, uint8_t rw, uint8_t e, uint8_t data); //The levels of the lines, data has D7 at its highest bit
+	void Byte(uint8_t rs, uint8_t value); //A whole byte from the MCU
+	void Move(int8_t step); //Move the address counter after a character
+	void Row(uint8_t row, char *text); //The characters shown on a row from 0, (text) must have a place for (cols) characters and the terminator
+
+	uint8_t cols, rows;
+	uint8_t ddram[2][40]; //The two DDRAM lines
+	uint8_t cgram[64];
+	uint8_t address; //The address counter, a DDRAM address, or a CGRAM one if cgram_selected is set
+	uint8_t cgram_selected;
+	uint8_t increment; //The I/D bit of the entry mode
+	uint8_t shift_on_write; //The S bit of the entry mode
+	uint8_t shift; //The display shift, the first DDRAM place of the line that is shown at the first column
+	uint8_t display_control; //The last display control instruction
+	uint8_t four_bit; //Set in the 4-bit mode
+	uint8_t nibble; //Set when the upper four bits of a byte were received in the 4-bit mode
+	uint8_t upper; //The upper four bits
+	uint8_t read_nibble; //Set when the upper four bits of a read were sent in the 4-bit mode
+	uint8_t read_byte; //The busy flag and the address counter of the running read
+	uint8_t e_last; //The last level of the Enable line
+	uint8_t reading; //Set while the LCD drives the data lines
+	uint8_t read_value; //The value of the read
+	uint64_t busy_until; //The cycle at which the running instruction ends
+	int8_t pins[11][2]; //The PORT and the bit of each line, -1 if not connected
+	uint32_t instructions; //Instructions executed
+	uint32_t writes; //Characters written to the DDRAM or CGRAM
+	uint32_t reads; //Busy flag and address reads
+	uint32_t violations; //Bytes written while the LCD was busy, which the LCD ignored
+};
+
+/*
+* PCF8574 I/O expander of an LCD backpack, P0=RS, P1=R/W, P2=Enable, P3=Backlight, P4=D4, P5=D5, P6=D6, P7=D7
+*/
+class Host_PCF8574 : public Host_TWI_Device
+{
+public:
+	Host_PCF8574(Host_HD44780 *lcd, uint8_t address = 0x27);
+	uint8_t Write(uint8_t data);
+	uint8_t Read(void);
+
+	Host_HD44780 *lcd;
+	uint8_t output; //The last written byte
+};
+
+#endif
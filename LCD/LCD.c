@@ -1,195 +1,970 @@
 #include "LCD.h"
 
-void LCD_WriteInstruction(uint8_t instr) //Write instruction to the LCD according to data sheet
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+#include "../BMP_180/TWI.h"
+#if !TWI_FREQ_VALID(LCD_PCF8574_FREQ)
+#error "LCD_PCF8574_FREQ must be up to 400kHz and between F_CPU/(16 + 2*255*64) and F_CPU/16"
+#endif
+#endif
+
+#if LCD_QUEUE_ENABLE && LCD_BUSY_FLAG_ENABLE
+#error "LCD_QUEUE_ENABLE and LCD_BUSY_FLAG_ENABLE can't be used together"
+#endif
+#if (LCD_TRANSPORT == LCD_TRANSPORT_PCF8574) && (LCD_QUEUE_ENABLE || LCD_BUSY_FLAG_ENABLE)
+#error "LCD_QUEUE_ENABLE and LCD_BUSY_FLAG_ENABLE work only with the parallel interfaces"
+#endif
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+#define LCD_FUNC_SET_DL (1 << 4) //The data length bit of the function set, for the 8-bit interface
+#else
+#define LCD_FUNC_SET_DL 0
+#endif
+
+void LCD_Bus_Set(uint8_t value, uint8_t rs);
+void LCD_Data_Direction(uint8_t output);
+uint8_t LCD_Bus_Read(void);
+void LCD_Write_Bus(uint8_t value, uint8_t rs);
+void LCD_Write_Byte(uint8_t data, uint8_t rs);
+void LCD_Queue_Put(uint8_t data, uint8_t rs);
+void LCD_Expander_Write(const uint8_t *data, uint8_t count);
+void LCD_Glyph_Touch(uint8_t slot);
+uint8_t LCD_Glyph_Visible(uint8_t slot);
+void LCD_Glyph_Reset(void);
+void LCD_Glyph_Mark(uint8_t row, uint8_t col, unsigned char data);
+void LCD_Send(uint8_t data, uint8_t rs);
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+uint8_t lcd_backlight = LCD_BACKLIGHT; //The state of the backlight PIN, added to every byte sent to the PCF8574
+uint8_t lcd_expander_last = 0; //The last byte sent to the PCF8574
+uint8_t lcd_error = 0; //The first TWI error of the PCF8574 since the last LCD_Error(), TWI_OK if there was none
+#endif
+
+#if LCD_BUSY_FLAG_ENABLE
+uint8_t lcd_busy_fallback = 0; //Set when the busy flag can't be read, then the fixed delays are used
+#endif
+
+#if LCD_BUSY_FLAG_ENABLE || LCD_QUEUE_ENABLE
+#define LCD_Command_Delay() //The end of the command is found from the busy flag, or waited by the queue interrupt
+#else
+#define LCD_Command_Delay() _delay_us(50)
+#endif
+
+#if LCD_QUEUE_ENABLE
+//Timer2 clock select bits and compare value for the queue tick
+#if LCD_QUEUE_PRESCALER == 8
+#define LCD_QUEUE_CLOCK (1 << CS21)
+#elif LCD_QUEUE_PRESCALER == 32
+#define LCD_QUEUE_CLOCK ((1 << CS21) | (1 << CS20))
+#elif LCD_QUEUE_PRESCALER == 64
+#define LCD_QUEUE_CLOCK (1 << CS22)
+#else
+#error "LCD_QUEUE_PRESCALER must be 8, 32 or 64"
+#endif
+#define LCD_QUEUE_OCR ((F_CPU / 1000000UL) * LCD_QUEUE_TICK_US / LCD_QUEUE_PRESCALER - 1)
+#if LCD_QUEUE_OCR > 255 || LCD_QUEUE_OCR < 1
+#error "LCD_QUEUE_TICK_US doesn't fit in Timer2 with this LCD_QUEUE_PRESCALER"
+#endif
+
+//Extra ticks to wait after a byte, the next byte starts two ticks after the last ENABLE pulse anyway
+#define LCD_QUEUE_WAIT_TICKS(us) ((((us) + LCD_QUEUE_TICK_US - 1) / LCD_QUEUE_TICK_US > 2) ? (((us) + LCD_QUEUE_TICK_US - 1) / LCD_QUEUE_TICK_US - 2) : 0)
+
+typedef struct
+{
+	uint8_t data; //The byte to send
+	uint8_t rs; //Zero for an instruction, RS for data
+} LCD_Queue_Entry;
+
+LCD_Queue_Entry lcd_queue[LCD_QUEUE_SIZE]; //The bytes waiting to be sent, the first one is being sent
+volatile uint8_t lcd_queue_first = 0; //Place of the first byte in the queue
+volatile uint8_t lcd_queue_count = 0; //Number of bytes in the queue
+uint8_t lcd_queue_phase = 0; //Step of the first byte, two for each nibble and then the wait for the command
+uint8_t lcd_queue_wait = 0; //Ticks left until the LCD finishes the command
+uint8_t lcd_queue_high_water = 0; //The most bytes that were in the queue at the same time
+
+/*
+* Send the first byte of the queue, one change of the ENABLE PIN at each tick
+* After the byte the ticks that the command needs are waited and then the byte is removed from the queue
+* The interrupt is disabled when the queue is empty
+*/
+ISR(TIMER2_COMPA_vect)
 {
-	LCD_PORT = (1<<0);
-	uint8_t out = instr & 0b11110000; //Upper bits
+	LCD_Queue_Entry *entry = &lcd_queue[lcd_queue_first];
 	
-	LCD_PORT |= out; //Send the Upper four bits
+	switch (lcd_queue_phase)
+	{
+		case 0: //Upper four bits, or the whole byte on the 8-bit interface
+		case 2: //Lower four bits
+			LCD_Bus_Set((lcd_queue_phase == 0) ? entry->data : (uint8_t)(entry->data << 4), entry->rs);
+			PIN_HIGH(LCD_E_PIN); //The data is set at least one cycle before the ENABLE PIN
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+			lcd_queue_phase = 3; //One pulse is enough for the whole byte
+#else
+			lcd_queue_phase++;
+#endif
+			break;
+		case 1:
+			PIN_LOW(LCD_E_PIN);
+			lcd_queue_phase++;
+			break;
+		case 3:
+			PIN_LOW(LCD_E_PIN);
+			if (!entry->rs && (entry->data < 0b00000100)) //Clear and return home are the slow commands
+				lcd_queue_wait = LCD_QUEUE_WAIT_TICKS(2000);
+			else
+				lcd_queue_wait = LCD_QUEUE_WAIT_TICKS(50);
+			lcd_queue_phase++;
+			break;
+		default: //Wait for the LCD to finish the command
+			if (lcd_queue_wait)
+			{
+				lcd_queue_wait--;
+				break;
+			}
+			lcd_queue_phase = 0;
+			lcd_queue_first = (lcd_queue_first + 1) % LCD_QUEUE_SIZE;
+			if (--lcd_queue_count == 0)
+				TIMSK2 &= ~(1 << OCIE2A);
+			break;
+	}
+}
+#endif
+
+//The DDRAM addresses of the rows, the third and the fourth row continue the lines of the first two after their columns
+#define LCD_ROW1_ADDR 0x00
+#define LCD_ROW2_ADDR 0x40
+#define LCD_ROW3_ADDR (LCD_ROW1_ADDR + LCD_COLS)
+#define LCD_ROW4_ADDR (LCD_ROW2_ADDR + LCD_COLS)
+
+uint8_t lcd_cursor_x = 0, lcd_cursor_y = 0; //Position of the cursor, both from zero, x is LCD_COLS after the last column until the next character
+uint8_t lcd_cursor_lost = 0; //Set when the LCD address was moved without LCD_SetCursor(), the cursor is set again before the next character
+
+//Powers of ten for the number writing functions, the digits are found by subtraction
+const uint32_t lcd_powers_of_ten[10] PROGMEM = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+#if LCD_SHADOW_ENABLE
+unsigned char lcd_shadow[LCD_ROWS][LCD_COLS]; //The characters that should be on the screen
+unsigned char lcd_sent[LCD_ROWS][LCD_COLS]; //The characters that were sent to the LCD
+uint8_t lcd_buf_x = 0, lcd_buf_y = 0; //Position of the next character in the copy, both from zero
+#endif
+
+#if LCD_MARQUEE_ENABLE
+//The display shift moves all the rows together, so there is only one marquee
+#if LCD_ROWS > 2
+#define LCD_MARQUEE_VISIBLE (2 * LCD_COLS) //The first and the third row show the same DDRAM line, the same for the second and the fourth
+#else
+#define LCD_MARQUEE_VISIBLE LCD_COLS
+#endif
+
+char *lcd_marquee_text = 0; //The scrolled string, zero when no marquee runs
+uint16_t lcd_marquee_length = 0; //Length of the string
+uint16_t lcd_marquee_cycle = 0; //Characters until the text repeats, the length plus the gap for long texts
+uint16_t lcd_marquee_index = 0; //Place in the text of the character that comes next on the screen
+uint8_t lcd_marquee_line = 0; //DDRAM address of the line
+uint8_t lcd_marquee_cell = 0; //Place in the DDRAM line of the character that comes next on the screen
+uint8_t lcd_marquee_preloaded = 0; //Steps left until the characters written at the start are used up
+uint8_t lcd_marquee_period = 1, lcd_marquee_countdown = 1; //Ticks for each step and ticks left for the next one
+#endif
+
+#if LCD_GLYPH_ENABLE
+const uint8_t *lcd_glyph_slot[8]; //The glyph at each CGRAM place, zero if the place is empty
+uint8_t lcd_glyph_refs[8]; //How many times each glyph was taken and not released
+uint8_t lcd_glyph_order[8]; //The CGRAM places from the most to the least recently used
+uint8_t lcd_glyph_cells[(LCD_ROWS*LCD_COLS + 1)/2]; //The CGRAM place plus one of each cell that shows a glyph, zero for the other characters, two cells in each byte
+#endif
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+/*
+* Send bytes to the PCF8574 in one I2C transaction, each byte sets all the PINS of the LCD
+* With the TWI queue enabled the transaction goes through the queue, so it doesn't collide with the other devices of the bus
+* A failed transaction is kept for LCD_Error(), the next bytes are still sent, so the LCD works again when the bus recovers
+*/
+void LCD_Expander_Write(const uint8_t *data, uint8_t count)
+{
+	uint8_t error;
+#if TWI_ASYNC_ENABLE
+	TWI_Transaction trans = {LCD_PCF8574_ADDR, data, count, 0, 0, 0, TWI_TRANS_IDLE, TWI_OK, TWI_SPEED(LCD_PCF8574_FREQ)};
+	
+	while (!TWISubmit(&trans)) //Wait for a free place in the queue
+		TWIWaitFree();
+	error = TWIWait(&trans);
+#else
+	TWISetSpeed(TWI_SPEED(LCD_PCF8574_FREQ));
+	error = TWIWriteBytes(LCD_PCF8574_ADDR, data, count);
+#endif
+	if (error && !lcd_error)
+		lcd_error = error;
+	lcd_expander_last = data[count - 1];
+}
+
+uint8_t LCD_Error(void)
+{
+	uint8_t error = lcd_error;
+	
+	lcd_error = TWI_OK;
+	return error;
+}
+
+/*
+* Send the upper four bits of (value) with the RS PIN as given by (rs) and strobe the ENABLE PIN
+* Each byte on the I2C bus takes about 90us at 100kHz, so the PCF8574 gives the timing of the pulse without delays
+*/
+void LCD_Write_Bus(uint8_t value, uint8_t rs)
+{
+	uint8_t out[3];
+	
+	out[0] = (value & 0b11110000) | rs | lcd_backlight; //RS is set before ENABLE
+	out[1] = out[0] | ENABLE;
+	out[2] = out[0]; //The data is held while ENABLE falls
+	LCD_Expander_Write(out, 3);
+}
+#else
+/*
+* Place (value) on the data PINS, only the upper four bits on the 4-bit interface, with the RS PIN as given by (rs)
+*/
+void LCD_Bus_Set(uint8_t value, uint8_t rs)
+{
+	PIN_WRITE(LCD_RS_PIN, rs);
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+	PIN_WRITE(LCD_D0_PIN, value & (1 << 0));
+	PIN_WRITE(LCD_D1_PIN, value & (1 << 1));
+	PIN_WRITE(LCD_D2_PIN, value & (1 << 2));
+	PIN_WRITE(LCD_D3_PIN, value & (1 << 3));
+#endif
+	PIN_WRITE(LCD_D4_PIN, value & (1 << 4));
+	PIN_WRITE(LCD_D5_PIN, value & (1 << 5));
+	PIN_WRITE(LCD_D6_PIN, value & (1 << 6));
+	PIN_WRITE(LCD_D7_PIN, value & (1 << 7));
+}
+
+/*
+* Set the data PINS to outputs if (output) is not zero, else to inputs
+*/
+void LCD_Data_Direction(uint8_t output)
+{
+	if (output)
+	{
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+		PIN_OUTPUT(LCD_D0_PIN);
+		PIN_OUTPUT(LCD_D1_PIN);
+		PIN_OUTPUT(LCD_D2_PIN);
+		PIN_OUTPUT(LCD_D3_PIN);
+#endif
+		PIN_OUTPUT(LCD_D4_PIN);
+		PIN_OUTPUT(LCD_D5_PIN);
+		PIN_OUTPUT(LCD_D6_PIN);
+		PIN_OUTPUT(LCD_D7_PIN);
+	}
+	else
+	{
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+		PIN_INPUT(LCD_D0_PIN);
+		PIN_INPUT(LCD_D1_PIN);
+		PIN_INPUT(LCD_D2_PIN);
+		PIN_INPUT(LCD_D3_PIN);
+#endif
+		PIN_INPUT(LCD_D4_PIN);
+		PIN_INPUT(LCD_D5_PIN);
+		PIN_INPUT(LCD_D6_PIN);
+		PIN_INPUT(LCD_D7_PIN);
+	}
+}
+
+#if LCD_BUSY_FLAG_ENABLE
+/*
+* Read the data PINS, on the 4-bit interface D4-D7 are returned as the upper four bits
+*/
+uint8_t LCD_Bus_Read(void)
+{
+	uint8_t value = 0;
+	
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+	if (PIN_READ(LCD_D0_PIN)) value |= (1 << 0);
+	if (PIN_READ(LCD_D1_PIN)) value |= (1 << 1);
+	if (PIN_READ(LCD_D2_PIN)) value |= (1 << 2);
+	if (PIN_READ(LCD_D3_PIN)) value |= (1 << 3);
+#endif
+	if (PIN_READ(LCD_D4_PIN)) value |= (1 << 4);
+	if (PIN_READ(LCD_D5_PIN)) value |= (1 << 5);
+	if (PIN_READ(LCD_D6_PIN)) value |= (1 << 6);
+	if (PIN_READ(LCD_D7_PIN)) value |= (1 << 7);
+	return value;
+}
+#endif
+
+/*
+* Place (value) on the data PINS with the RS PIN as given by (rs) and strobe the ENABLE PIN
+* On the 4-bit interface only the upper four bits are sent
+*/
+void LCD_Write_Bus(uint8_t value, uint8_t rs)
+{
+	LCD_Bus_Set(value, rs);
+#if LCD_BUSY_FLAG_ENABLE
+	if (!lcd_busy_fallback) //The end of the command is found from the busy flag, so only the timing of the pulse is needed
+	{
+		_delay_us (1);
+		PIN_HIGH(LCD_E_PIN);
+		_delay_us (1); //The ENABLE pulse must be longer than 450ns
+		PIN_LOW(LCD_E_PIN);
+		_delay_us (1);
+		return;
+	}
+#endif
 	_delay_us (100); //Delay as needed
-	LCD_PORT |= ENABLE; //Set the ENABLE PIN as needed
+	PIN_HIGH(LCD_E_PIN); //Set the ENABLE PIN as needed
 	_delay_us (100);
-	LCD_PORT &= ~ENABLE; //Unset the ENABLE PIN
+	PIN_LOW(LCD_E_PIN); //Unset the ENABLE PIN
 	_delay_us (50);
+}
+#endif
+
+/*
+* Send a byte with RS set as (rs), zero for an instruction and RS for data
+* The 4-bit interfaces send it as two nibbles, upper bits first
+*/
+void LCD_Write_Byte(uint8_t data, uint8_t rs)
+{
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+	uint8_t out[6], count = 0;
 	
-	LCD_PORT &= (1<<0);
-	out = instr << 4; //Four Lower bits
-	LCD_PORT |= out; //Send the bits
-	_delay_us (100);
-	LCD_PORT |= ENABLE; //Set the ENABLE PIN as needed
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE; //Unset the ENABLE PIN
-	_delay_us (50);
+	if ((lcd_expander_last & (RS | RW | LCD_BACKLIGHT)) != (rs | lcd_backlight)) //RS must be set before ENABLE, if it changes it is sent first
+		out[count++] = (data & 0b11110000) | rs | lcd_backlight;
+	//The PINS of the PCF8574 change together, so the data of each nibble is set with the rising ENABLE and held while it falls
+	out[count++] = (data & 0b11110000) | rs | lcd_backlight | ENABLE;
+	out[count++] = (data & 0b11110000) | rs | lcd_backlight;
+	out[count++] = (data << 4) | rs | lcd_backlight | ENABLE;
+	out[count++] = (data << 4) | rs | lcd_backlight;
+	LCD_Expander_Write(out, count); //The whole byte in one transaction
+#elif LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+	LCD_Write_Bus(data, rs);
+#else
+	LCD_Write_Bus(data, rs); //Upper four bits
+	LCD_Write_Bus(data << 4, rs); //Lower four bits
+#endif
+#if LCD_BUSY_FLAG_ENABLE
+	if (!lcd_busy_fallback)
+	{
+		LCD_Get_Address(); //Wait until the LCD is ready
+		return;
+	}
+	_delay_us (50); //Without the busy flag wait the time of the command
+#endif
+	if (!rs && (data < 0b00000100)) //Clear and return home are the slow commands
+		_delay_ms (2);
 }
 
-void LCD_WriteChar(unsigned char data)
+#if LCD_BUSY_FLAG_ENABLE
+/*
+* Read the busy flag and the address counter until the LCD is ready, the data PINS are inputs during the reading
+* The flag is on D7 and the address on the rest bits, on the 4-bit interface upper bits at the first nibble and lower at the second
+* If the LCD stays busy longer than LCD_BUSY_TIMEOUT_US, the R/W PIN is probably not connected, so the fixed delays are used from now on
+*/
+uint8_t LCD_Get_Address(void)
 {
-	LCD_PORT &= (1<<0);
-	unsigned char out = data & 0b11110000; //Upper four bits
+	uint8_t value = 0xFF;
 	
-	LCD_PORT |= (out | RS); //Send the data out and also set the RS PIN to high as needed
-	_delay_us (100); //Delay as protocol suggests
-	LCD_PORT |= ENABLE; //Set the Enable PIN to high as needed
-	_delay_us (100); //Delay
-	LCD_PORT &= ~ENABLE; 
-	_delay_us (50);
+	if (lcd_busy_fallback)
+		return 0xFF;
 	
-	LCD_PORT &= (1<<0);	
-	out = data << 4; //Lower four bits
-	LCD_PORT |= (out | RS);
-	_delay_us (100);
-	LCD_PORT |= ENABLE; //Set the ENABLE to HIGH
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE; //And now LOW
-	_delay_us (50);
+	LCD_Data_Direction(0); //Data PINS to input...
+	LCD_Bus_Set(0, 0); //...without the pull-up resistors
+	PIN_HIGH(LCD_RW_PIN); //Read the instruction register
+	for (uint16_t count = 0; count < (LCD_BUSY_TIMEOUT_US / 4); count++) //Each reading takes about 4us
+	{
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+		PIN_HIGH(LCD_E_PIN);
+		_delay_us (1); //Data is valid 360ns after ENABLE
+		value = LCD_Bus_Read();
+		PIN_LOW(LCD_E_PIN);
+		_delay_us (3);
+#else
+		PIN_HIGH(LCD_E_PIN);
+		_delay_us (1); //Data is valid 360ns after ENABLE
+		value = LCD_Bus_Read();
+		PIN_LOW(LCD_E_PIN);
+		_delay_us (1);
+		PIN_HIGH(LCD_E_PIN); //The lower four bits must be read too, even if they are not needed
+		_delay_us (1);
+		value |= LCD_Bus_Read() >> 4;
+		PIN_LOW(LCD_E_PIN);
+		_delay_us (1);
+#endif
+		if (!(value & 0b10000000)) //Ready
+			break;
+	}
+	PIN_LOW(LCD_RW_PIN);
+	LCD_Data_Direction(1); //Data PINS back to output
+	
+	if (value & 0b10000000) //Timeout, wait for the slowest command and stop using the busy flag
+	{
+		lcd_busy_fallback = 1;
+		_delay_ms (2);
+		return 0xFF;
+	}
+	return value;
+}
+#endif
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+void LCD_Backlight_ON(void)
+{
+	uint8_t out;
+	
+	lcd_backlight = LCD_BACKLIGHT;
+	out = lcd_expander_last | LCD_BACKLIGHT;
+	LCD_Expander_Write(&out, 1);
+}
+
+void LCD_Backlight_OFF(void)
+{
+	uint8_t out;
+	
+	lcd_backlight = 0;
+	out = lcd_expander_last & ~LCD_BACKLIGHT;
+	LCD_Expander_Write(&out, 1);
+}
+#endif
+
+#if LCD_QUEUE_ENABLE
+/*
+* Place a byte at the end of the queue and start the interrupt, if the queue is full wait for a free place
+* The interrupts must be enabled, otherwise the queue is never emptied
+*/
+void LCD_Queue_Put(uint8_t data, uint8_t rs)
+{
+	uint8_t sreg;
+	
+	while (lcd_queue_count >= LCD_QUEUE_SIZE) //Wait for a free place
+		HAL_Idle();
+	
+	sreg = SREG;
+	cli();
+	lcd_queue[(lcd_queue_first + lcd_queue_count) % LCD_QUEUE_SIZE].data = data;
+	lcd_queue[(lcd_queue_first + lcd_queue_count) % LCD_QUEUE_SIZE].rs = rs;
+	lcd_queue_count++;
+	if (lcd_queue_count > lcd_queue_high_water)
+		lcd_queue_high_water = lcd_queue_count;
+	TIMSK2 |= (1 << OCIE2A);
+	SREG = sreg;
+}
+
+void LCD_Sync(void)
+{
+	while (lcd_queue_count) //The last byte leaves the queue after the LCD has finished it
+		HAL_Idle();
+}
+
+uint8_t LCD_Queue_High_Water(void)
+{
+	return lcd_queue_high_water;
+}
+#endif
+
+/*
+* Send a byte to the LCD, or place it in the queue, without moving the cursor position kept by the library
+*/
+void LCD_Send(uint8_t data, uint8_t rs)
+{
+#if LCD_QUEUE_ENABLE
+	LCD_Queue_Put(data, rs);
+#else
+	LCD_Write_Byte(data, rs);
+#endif
+}
+
+void LCD_WriteInstruction(uint8_t instr) //Write instruction to the LCD according to data sheet
+{
+	LCD_Send(instr, 0);
+}
+
+/*
+* Write a character at the cursor and move to the next column
+* After the last column the next character goes to the start of the next row, the LCD address would continue to a different row
+*/
+void LCD_WriteChar(unsigned char data)
+{
+	if (lcd_cursor_x >= LCD_COLS)
+	{
+		lcd_cursor_x = 0;
+		if (++lcd_cursor_y >= LCD_ROWS)
+			lcd_cursor_y = 0;
+		lcd_cursor_lost = 1;
+	}
+	if (lcd_cursor_lost)
+		LCD_SetCursor(lcd_cursor_x, lcd_cursor_y + 1);
+	
+	LCD_Send(data, RS); //Set also the RS PIN to high as needed
+#if LCD_GLYPH_ENABLE
+	LCD_Glyph_Mark(lcd_cursor_y, lcd_cursor_x, data);
+#endif
+	lcd_cursor_x++;
 }
 
 void LCD_WriteStr(char *str_data)
 {
-	uint8_t string_len = strlen(str_data);
-	for(uint8_t i = 0; i < string_len; i++)
-		LCD_WriteChar(str_data[i]);
+	while (*str_data)
+		LCD_WriteChar(*str_data++);
+}
+
+void LCD_WriteStr_P(const char *str_data)
+{
+	char data;
+	
+	while ((data = pgm_read_byte(str_data++)))
+		LCD_WriteChar(data);
+}
+
+/*
+* Write a number with a point before its last (decimals) digits, with at least one digit before the point
+* The digits are found by subtracting powers of ten, so there is no division and no buffer
+*/
+void LCD_WriteFixed(int32_t value, uint8_t decimals, uint8_t width)
+{
+	uint32_t number = (value < 0) ? -(uint32_t)value : (uint32_t)value; //Also correct for the most negative value
+	uint8_t digits = 1, length;
+	
+	if (decimals > 9)
+		decimals = 9;
+	while ((digits < 10) && (number >= pgm_read_dword(&lcd_powers_of_ten[digits])))
+		digits++;
+	if (digits <= decimals)
+		digits = decimals + 1;
+	
+	length = digits + (value < 0) + (decimals != 0);
+	for (; width > length; width--) //Right alignment
+		LCD_WriteChar(' ');
+	if (value < 0)
+		LCD_WriteChar('-');
+	
+	while (digits--)
+	{
+		uint32_t power = pgm_read_dword(&lcd_powers_of_ten[digits]);
+		char digit = '0';
+		
+		while (number >= power)
+		{
+			number -= power;
+			digit++;
+		}
+		LCD_WriteChar(digit);
+		if (decimals && (digits == decimals))
+			LCD_WriteChar('.');
+	}
+}
+
+void LCD_WriteInt(int32_t value, uint8_t width)
+{
+	LCD_WriteFixed(value, 0, width);
 }
 
 void LCD_SetCursor (uint8_t x_position, uint8_t y_position)
 {
+	lcd_cursor_x = x_position;
+	lcd_cursor_y = y_position ? (y_position - 1) : 0;
+	lcd_cursor_lost = 0;
+	
 	if(y_position == 1)
-		y_position = 0;
+		y_position = LCD_ROW1_ADDR;
 	else if(y_position == 2)
-		y_position = 0x40;
+		y_position = LCD_ROW2_ADDR;
 	
 	#if LCD_ROWS > 2
 		else if(y_position == 3) //These conditions for the 4 row LCD
-			y_position = 0x14;
+			y_position = LCD_ROW3_ADDR;
 		else if(y_position == 4)
-			y_position = 0x54;
+			y_position = LCD_ROW4_ADDR;
 	#endif
 	LCD_WriteInstruction(LCD_SETDDRAM_ADRR_COMMAND | (x_position + y_position));
 }
 
 inline void LCD_ClearDisplay(void) //Clear display and reset cursor
 {
-	LCD_WriteInstruction(CLEAR_DISP_RES_CURS);
-	_delay_ms(2);
+	LCD_WriteInstruction(CLEAR_DISP_RES_CURS); //The wait for the clear is done after the instruction
+#if LCD_GLYPH_ENABLE
+	memset(lcd_glyph_cells, 0, sizeof(lcd_glyph_cells));
+#endif
+	lcd_cursor_x = 0;
+	lcd_cursor_y = 0;
+	lcd_cursor_lost = 0;
 }
 
 void InitLCD (void)
 {
-	LCD_DDR |= ~(1<<0); // PORTx1:7 outputs (LCD)
-	LCD_PORT &= (1<<0); //Start the LCD
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+#if LCD_TWI_INIT
+	TWIInit();
+#endif
+	lcd_expander_last = lcd_backlight;
+	LCD_Expander_Write(&lcd_expander_last, 1); //All the PINS LOW, except the backlight
+#else
+	PIN_LOW(LCD_RW_PIN); //Control PINS LOW...
+	PIN_LOW(LCD_E_PIN);
+	PIN_OUTPUT(LCD_RW_PIN); //...and outputs
+	PIN_OUTPUT(LCD_RS_PIN);
+	PIN_OUTPUT(LCD_E_PIN);
+	LCD_Bus_Set(0, 0); //Data PINS and RS LOW...
+	LCD_Data_Direction(1); //...and outputs
+#endif
 	
 	_delay_ms (20); //Power on delay needed in order for the internal circuits to stabilize
-	uint8_t out = 0b00110000; //Indicate 4-bit long mode
 	
-	//First initialization as suggested from the data sheet
-	LCD_PORT |= out;
-	_delay_us (100);
-	LCD_PORT |= ENABLE;
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE;
+	//The LCD starts in 8-bit mode, so the first bytes are sent only with D4-D7 on the 4-bit interfaces
+	LCD_Write_Bus(0b00110000, 0); //First initialization as suggested from the data sheet
 	_delay_ms (5);
-	
-	//Second initialization as suggested from the data sheet
-	LCD_PORT |= ENABLE;
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE;
+	LCD_Write_Bus(0b00110000, 0); //Second initialization as suggested from the data sheet
 	_delay_us (200);
-	
-	//Third and final initialization as suggested from the data sheet
-	LCD_PORT |= ENABLE;
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE;
+	LCD_Write_Bus(0b00110000, 0); //Third and final initialization as suggested from the data sheet
 	_delay_ms (5);
 	
-	LCD_PORT &= (1<<0);
-	out = 0b00100000; //Indicate that we want a 4-bit interface mode
-	LCD_PORT |= out;
-	_delay_us (100);
-	LCD_PORT |= ENABLE;
-	_delay_us (100);
-	LCD_PORT &= ~ENABLE;
+#if LCD_TRANSPORT != LCD_TRANSPORT_PARALLEL8
+	LCD_Write_Bus(0b00100000, 0); //Indicate that we want a 4-bit interface mode
 	_delay_us (50);
+#endif
 	
 	//Finlay send the necessary instructions to finalize the LCD initialization. After this commands and the delay, the LCD is ready for use
-	LCD_WriteInstruction(INTISL_DISPLAY_FUNC_SET | (1 << 2)); // 001, 4 bit, 2 lines 2x16 (4 lines 4x20), 5x11 dots (LCD),xx
-	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND & ~(1 << 2)); // 00001xxx, Display off, cursor off, blinking off (LCD)
-	LCD_WriteInstruction(CURS_MOV_DIR_DISP_NOT_SFT); // 000001xx, Cursor increase, display not shift (LCD)
-	LCD_WriteInstruction(CLEAR_DISP_RES_CURS); //Clear display, reset cursor (LCD)
-	_delay_ms (2); //Give the needed time to the LCD to be initialized internally, in order to be ready to receive commands
+	//They are sent directly, also with the queue enabled, so the initialization doesn't need the interrupts
+	LCD_Write_Byte(INTISL_DISPLAY_FUNC_SET | LCD_FUNC_SET_DL | (1 << 2), 0); // 001, 4 or 8 bit, 2 lines 2x16 (4 lines 4x20), 5x11 dots (LCD),xx
+	LCD_Write_Byte(DISP_ON_CUR_NS_COMMAND & ~(1 << 2), 0); // 00001xxx, Display off, cursor off, blinking off (LCD)
+	LCD_Write_Byte(CURS_MOV_DIR_DISP_NOT_SFT, 0); // 000001xx, Cursor increase, display not shift (LCD)
+	LCD_Write_Byte(CLEAR_DISP_RES_CURS, 0); //Clear display, reset cursor (LCD), the byte function gives the needed time to the LCD to be initialized internally
 	
-	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND); //Turn the Display on
+	LCD_Write_Byte(DISP_ON_CUR_NS_COMMAND, 0); //Turn the Display on
+	lcd_cursor_x = 0; //The clear sent the cursor to the first position
+	lcd_cursor_y = 0;
+	lcd_cursor_lost = 0;
+	
+#if LCD_QUEUE_ENABLE
+	//Timer2 in CTC mode gives the ticks of the queue, its interrupt is enabled when there is something to send
+	TCCR2A = (1 << WGM21);
+	OCR2A = LCD_QUEUE_OCR;
+	TCCR2B = LCD_QUEUE_CLOCK;
+#endif
+	
+#if LCD_SHADOW_ENABLE
+	LCD_Buf_Clear();
+	memset(lcd_sent, ' ', sizeof(lcd_sent)); //The screen is empty after the clear
+#endif
+#if LCD_GLYPH_ENABLE
+	LCD_Glyph_Reset();
+#endif
 }
 
 void LCD_AutoScroll(void)
 {
 	LCD_WriteInstruction(CURS_MOV_DIR_DISP_NOT_SFT | (1 << 0));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_No_AutoScroll(void)
 {
 	LCD_WriteInstruction(CURS_MOV_DIR_DISP_NOT_SFT & ~(1 << 0));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_CursorBlink(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND | (1 << 0));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_No_CursorBlink(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND & ~(1 << 0));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_ShowCursor(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND | (1 << 1));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_HideCursor(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND & ~(1 << 1));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Display_ON(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND | (1 << 2));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Display_OFF(void)
 {
 	LCD_WriteInstruction(DISP_ON_CUR_NS_COMMAND & ~(1 << 2));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Text_Dir_RightToLeft(void)
 {
 	LCD_WriteInstruction(CURS_MOV_DIR_DISP_NOT_SFT & ~(1 << 1));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Text_Dir_LeftToRight(void)
 {
 	LCD_WriteInstruction(CURS_MOV_DIR_DISP_NOT_SFT | (1 << 1));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Scroll_Disp_Left(void)
 {
-	//If you want display to shift left, set the 0001x(n)00 (n) bit to zero
+	//The display shifts with the 0001(s)(n)00 (s) bit set, to the left with the (n) bit to zero
 	LCD_WriteInstruction(DISP_SFT_AND_CURS_SFT | (1 << 3));
-	_delay_us(50);
+	LCD_Command_Delay();
 }
 
 void LCD_Scroll_Disp_Right(void)
 {
-	//If you want display to shift right, set the 0001x(n)00 (n) bit to one
-	LCD_WriteInstruction(DISP_SFT_AND_CURS_SFT & ~(1 << 3));
-	_delay_us(50);
-}
\ No newline at end of file
+	//If you want display to shift right, set also the 0001(s)(n)00 (n) bit to one
+	LCD_WriteInstruction(DISP_SFT_AND_CURS_SFT | (1 << 3) | (1 << 2));
+	LCD_Command_Delay();
+}
+
+void LCD_ReturnHome(void)
+{
+	LCD_WriteInstruction(RETURN_HOME); //The wait for the instruction is done after it
+	lcd_cursor_x = 0;
+	lcd_cursor_y = 0;
+	lcd_cursor_lost = 0;
+}
+
+#if LCD_SHADOW_ENABLE
+void LCD_Buf_SetCursor(uint8_t x_position, uint8_t y_position)
+{
+	lcd_buf_x = (x_position < LCD_COLS) ? x_position : 0;
+	lcd_buf_y = ((y_position > 0) && (y_position <= LCD_ROWS)) ? (y_position - 1) : 0; //The rows start from one like LCD_SetCursor()
+}
+
+void LCD_Buf_WriteChar(unsigned char data)
+{
+	lcd_shadow[lcd_buf_y][lcd_buf_x] = data;
+	if (++lcd_buf_x >= LCD_COLS) //Continue at the start of the next row, and from the first row after the last one
+	{
+		lcd_buf_x = 0;
+		if (++lcd_buf_y >= LCD_ROWS)
+			lcd_buf_y = 0;
+	}
+}
+
+void LCD_Buf_WriteStr(char *str_data)
+{
+	while (*str_data)
+		LCD_Buf_WriteChar(*str_data++);
+}
+
+void LCD_Buf_Clear(void)
+{
+	memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+	lcd_buf_x = 0;
+	lcd_buf_y = 0;
+}
+
+/*
+* Send the characters of the copy that are different from the ones sent before
+* The LCD moves its address by itself after each character, so the cursor is set only when the next changed character isn't at the next address
+* The rows are checked in the order of their DDRAM addresses, so on a 4 row LCD the end of the first row continues to the third one without setting the cursor
+* The tables have the 4 rows of the largest LCD and the rows after LCD_ROWS are skipped
+*/
+void LCD_Flush(void)
+{
+	const uint8_t row_order[4] = {0, 2, 1, 3};
+	const uint8_t row_address[4] = {LCD_ROW1_ADDR, LCD_ROW2_ADDR, LCD_ROW3_ADDR, LCD_ROW4_ADDR};
+	uint8_t address = 0xFF; //The DDRAM address of the LCD cursor, unknown at the start because the other functions also move it
+	
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		uint8_t row = row_order[i];
+		
+		if (row >= LCD_ROWS)
+			continue;
+		for (uint8_t col = 0; col < LCD_COLS; col++)
+		{
+			if (lcd_shadow[row][col] == lcd_sent[row][col])
+				continue;
+			if (address != row_address[row] + col)
+				LCD_SetCursor(col, row + 1);
+			LCD_Send(lcd_shadow[row][col], RS);
+		#if LCD_GLYPH_ENABLE
+			LCD_Glyph_Mark(row, col, lcd_shadow[row][col]);
+		#endif
+			lcd_sent[row][col] = lcd_shadow[row][col];
+			address = row_address[row] + col + 1;
+		}
+	}
+	lcd_cursor_lost = 1; //The characters are sent in the order of the DDRAM addresses
+}
+#endif
+
+#if LCD_GLYPH_ENABLE
+/*
+* Forget all the glyphs, the CGRAM content is unknown at power up
+*/
+void LCD_Glyph_Reset(void)
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		lcd_glyph_slot[i] = 0;
+		lcd_glyph_refs[i] = 0;
+		lcd_glyph_order[i] = 7 - i; //The empty places are used from the first one
+	}
+	memset(lcd_glyph_cells, 0, sizeof(lcd_glyph_cells));
+}
+
+/*
+* Note the character written at a cell of the screen, so a CGRAM place can't be replaced while a cell shows it
+*/
+void LCD_Glyph_Mark(uint8_t row, uint8_t col, unsigned char data)
+{
+	uint8_t cell = row*LCD_COLS + col;
+	uint8_t value = (data & 0b11110000) ? 0 : ((data & 0b111) + 1); //The codes 0-7 and 8-15 are the same characters
+	
+	if (cell & 1)
+		lcd_glyph_cells[cell >> 1] = (lcd_glyph_cells[cell >> 1] & 0x0F) | (value << 4);
+	else
+		lcd_glyph_cells[cell >> 1] = (lcd_glyph_cells[cell >> 1] & 0xF0) | value;
+}
+
+/*
+* Move a CGRAM place to the start of the usage order
+*/
+void LCD_Glyph_Touch(uint8_t slot)
+{
+	uint8_t i = 0;
+	
+	while (lcd_glyph_order[i] != slot)
+		i++;
+	for (; i > 0; i--)
+		lcd_glyph_order[i] = lcd_glyph_order[i - 1];
+	lcd_glyph_order[0] = slot;
+}
+
+/*
+* Check if a CGRAM place is shown, its glyph would change on the screen if it was replaced
+* The cells written by LCD_WriteChar() and LCD_Flush() are noted, and with the screen copy the characters that wait for LCD_Flush() count too
+*/
+uint8_t LCD_Glyph_Visible(uint8_t slot)
+{
+	for (uint8_t i = 0; i < sizeof(lcd_glyph_cells); i++)
+		if (((lcd_glyph_cells[i] & 0x0F) == slot + 1) || ((lcd_glyph_cells[i] >> 4) == slot + 1))
+			return 1;
+#if LCD_SHADOW_ENABLE
+	const unsigned char *shadow = &lcd_shadow[0][0], *sent = &lcd_sent[0][0];
+	
+	for (uint8_t i = 0; i < (LCD_ROWS * LCD_COLS); i++) //The codes 0-7 and 8-15 are the same characters
+		if ((((shadow[i] & 0b11110000) == 0) && ((shadow[i] & 0b111) == slot)) || (((sent[i] & 0b11110000) == 0) && ((sent[i] & 0b111) == slot)))
+			return 1;
+#endif
+	return 0;
+}
+
+/*
+* Find the glyph in the CGRAM, or write it at the least recently used place that has no references and is not shown
+* The code 8 + place is returned, which shows the same character as the place, so it can be part of a string
+* Writing a glyph moves the LCD address to the CGRAM, the cursor is set again before the next character
+*/
+uint8_t LCD_Glyph_Get(const uint8_t *glyph)
+{
+	uint8_t slot = 0xFF;
+	
+	for (uint8_t i = 0; i < 8; i++)
+		if (lcd_glyph_slot[i] == glyph)
+			slot = i;
+	
+	if (slot == 0xFF) //Not in the CGRAM
+	{
+		for (int8_t i = 7; (i >= 0) && (slot == 0xFF); i--)
+			if (!lcd_glyph_refs[lcd_glyph_order[i]] && !LCD_Glyph_Visible(lcd_glyph_order[i]))
+				slot = lcd_glyph_order[i];
+		if (slot == 0xFF)
+			return 0xFF;
+		
+		LCD_WriteInstruction(LCD_SETCGRAM_ADDR_COMMAND | (slot << 3)); //Eight bytes for each place
+		for (uint8_t i = 0; i < 8; i++)
+			LCD_Send(pgm_read_byte(&glyph[i]), RS);
+		lcd_glyph_slot[slot] = glyph;
+		lcd_cursor_lost = 1;
+	}
+	
+	if (lcd_glyph_refs[slot] < 255)
+		lcd_glyph_refs[slot]++;
+	LCD_Glyph_Touch(slot);
+	return 8 + slot;
+}
+
+void LCD_Glyph_Put(const uint8_t *glyph)
+{
+	for (uint8_t i = 0; i < 8; i++)
+		if ((lcd_glyph_slot[i] == glyph) && lcd_glyph_refs[i])
+			lcd_glyph_refs[i]--;
+}
+#endif
+
+#if LCD_MARQUEE_ENABLE
+/*
+* Write the start of the string to the whole DDRAM line of the row, so the next characters are ready before they are shown
+* Then each step is a single display shift instruction and only a text longer than the line needs one more character written at each step
+* The display shift moves all the rows, so the other rows scroll together with the marquee
+*/
+void LCD_Marquee_Start(char *str_data, uint8_t y_position, uint8_t period)
+{
+	uint16_t length = 0;
+	
+	while (str_data[length])
+		length++;
+	
+	lcd_marquee_text = str_data;
+	lcd_marquee_length = length;
+	lcd_marquee_cycle = (length > LCD_DDRAM_LINE) ? (length + LCD_MARQUEE_GAP) : LCD_DDRAM_LINE; //A short text repeats with the DDRAM line itself
+	lcd_marquee_line = ((y_position == 2) || (y_position == 4)) ? 0x40 : 0; //The second and the fourth row are on the second line
+	lcd_marquee_period = period ? period : 1;
+	lcd_marquee_countdown = lcd_marquee_period;
+	
+	LCD_ReturnHome(); //Start without shift
+	LCD_WriteInstruction(LCD_SETDDRAM_ADRR_COMMAND | lcd_marquee_line);
+	for (uint8_t i = 0; i < LCD_DDRAM_LINE; i++)
+		LCD_Send((i < length) ? str_data[i] : ' ', RS);
+	lcd_cursor_lost = 1;
+	
+	//The character after the visible ones is the next to be shown
+	lcd_marquee_cell = LCD_MARQUEE_VISIBLE % LCD_DDRAM_LINE;
+	lcd_marquee_index = LCD_MARQUEE_VISIBLE % lcd_marquee_cycle;
+	lcd_marquee_preloaded = LCD_DDRAM_LINE - LCD_MARQUEE_VISIBLE;
+}
+
+/*
+* Count the ticks and shift the display once every period
+* For a text longer than the DDRAM line the character that comes on the screen is written before the shift, while its cell is still hidden
+* On 4 rows all the 40 cells of the line are shown, so the character is seen at the first column of the upper row until the shift moves it to the end of the lower row
+*/
+void LCD_Marquee_Tick(void)
+{
+	if (!lcd_marquee_text || --lcd_marquee_countdown)
+		return;
+	lcd_marquee_countdown = lcd_marquee_period;
+	
+	if (lcd_marquee_length > LCD_DDRAM_LINE)
+	{
+		if (lcd_marquee_preloaded) //Still written from the start
+			lcd_marquee_preloaded--;
+		else
+		{
+			LCD_WriteInstruction(LCD_SETDDRAM_ADRR_COMMAND | (lcd_marquee_line + lcd_marquee_cell));
+			LCD_Send((lcd_marquee_index < lcd_marquee_length) ? lcd_marquee_text[lcd_marquee_index] : ' ', RS);
+			lcd_cursor_lost = 1;
+		}
+	}
+	LCD_Scroll_Disp_Left();
+	if (++lcd_marquee_cell >= LCD_DDRAM_LINE)
+		lcd_marquee_cell = 0;
+	if (++lcd_marquee_index >= lcd_marquee_cycle)
+		lcd_marquee_index = 0;
+}
+
+void LCD_Marquee_Stop(void)
+{
+	lcd_marquee_text = 0;
+	LCD_ReturnHome();
+}
+#endif
\ No newline at end of file
@@ -5,37 +5,103 @@
 #define F_CPU 8000000UL
 #endif
 
-#include <avr/io.h>
-#include <util/delay.h>
 #include <string.h>
+#include "../HAL/HAL.h"
+#include "../Pins/Pins.h"
+
+//Interface to the LCD
+#define LCD_TRANSPORT_PARALLEL4 0 //4-bit interface, D4-D7 and the control PINS on any PINS
+#define LCD_TRANSPORT_PARALLEL8 1 //8-bit interface, D0-D7 and the control PINS on any PINS
+#define LCD_TRANSPORT_PCF8574 2 //4-bit interface through a PCF8574 I2C backpack, uses the TWI library of the BMP180
+#define LCD_TRANSPORT LCD_TRANSPORT_PARALLEL4 //Select one of the interfaces above
 
 /*
-* All the LCD PINS are on one port
-* Pin out for the PORT -> P1=R/W, P2=RS, P3=Enable, P4=D4, P5=D5, P6=D6, P7=D7
+* For the parallel interfaces each PIN is given as its PORT letter and bit, see ../Pins/README.md
+* Each PIN is changed on its own, so the rest PINS of the PORTS can be used by the application
+* Pin out for the PCF8574 -> P0=RS, P1=R/W, P2=Enable, P3=Backlight, P4=D4, P5=D5, P6=D6, P7=D7
 */
 
-#define LCD_PORT PORTD //Define the port of the MCU that the LCD is on
-#define LCD_DDR DDRD //And also define the register of the PORT
+#define LCD_RW_PIN D, 1 //R/W PIN, only needed with LCD_BUSY_FLAG_ENABLE, else it can be tied to ground
+#define LCD_RS_PIN D, 2 //RS PIN
+#define LCD_E_PIN D, 3 //Enable PIN
+#if LCD_TRANSPORT == LCD_TRANSPORT_PARALLEL8
+#define LCD_D0_PIN A, 0 //D0-D3 only for the 8-bit interface, PORTA leaves the TWI PINS PC0 and PC1 free
+#define LCD_D1_PIN A, 1
+#define LCD_D2_PIN A, 2
+#define LCD_D3_PIN A, 3
+#define LCD_D4_PIN A, 4
+#define LCD_D5_PIN A, 5
+#define LCD_D6_PIN A, 6
+#define LCD_D7_PIN A, 7
+#else
+#define LCD_D4_PIN D, 4
+#define LCD_D5_PIN D, 5
+#define LCD_D6_PIN D, 6
+#define LCD_D7_PIN D, 7
+#endif
 
-#define RS 0b00000100 //RS PIN 
-#define ENABLE 0b00001000 //Enable PIN
+#define LCD_PCF8574_ADDR 0x27 //7-bit address of the PCF8574, 0x27 with all the address PINS high, 0x3F for the PCF8574A
+#define LCD_PCF8574_FREQ 100000UL //SCL frequency of the PCF8574 transactions, it works up to 100kHz
+#define LCD_TWI_INIT 0 //Set to (1) to initialize the TWI interface at InitLCD(), if no other library does it
+
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+#define RS 0b00000001 //RS PIN
+#define RW 0b00000010 //R/W PIN
+#define ENABLE 0b00000100 //Enable PIN
+#define LCD_BACKLIGHT 0b00001000 //Backlight PIN
+#else
+#define RS 0b00000100 //Given as (rs) to send data instead of an instruction, sets LCD_RS_PIN
+#endif
 
 #define CLEAR_DISP_RES_CURS 0b00000001 //Clear Display and Reset Cursor (instruction)
+#define RETURN_HOME 0b00000010 //Send the cursor to the first position and undo the display shift, without clearing
 #define DISP_ON_CUR_NS_COMMAND 0b00001100
 #define INTISL_DISPLAY_FUNC_SET 0b00101000 // 001, 4 bit, 2 lines 2x16 (4 lines 4x20), 5x8 dots (LCD),xx
 #define CURS_MOV_DIR_DISP_NOT_SFT 0b00000110 // 000001xx, Cursor increase, display not shift (LCD)
 #define DISP_SFT_AND_CURS_SFT 0b00010000 //No shift of the display and no cursor shift
 #define LCD_SETDDRAM_ADRR_COMMAND 0b10000000 //Command to send the cursor to a specific DDRAM address
+#define LCD_SETCGRAM_ADDR_COMMAND 0b01000000 //Command to set the CGRAM address, for writing custom characters
 
 #define LCD_COLS 20 //Number of the LCD columns
 #define LCD_ROWS 4 //Number of the LCD rows
 
+#define LCD_BUSY_FLAG_ENABLE 0 //Set to (1) to read the busy flag of the LCD instead of waiting the worst case time, needs the R/W PIN connected and a parallel interface
+#define LCD_BUSY_TIMEOUT_US 3000 //If the LCD is busy for longer than this, the busy flag is not used any more and the fixed delays are used
+
+#define LCD_QUEUE_ENABLE 0 //Set to (1) to place the bytes for the LCD in a queue and send them from the Timer2 interrupt, needs a parallel interface and can't be used with LCD_BUSY_FLAG_ENABLE
+#define LCD_QUEUE_SIZE 32 //Number of bytes that the queue can hold, a power of two
+#define LCD_QUEUE_TICK_US 50 //Time between two interrupts, the ENABLE PIN changes once at each one
+#define LCD_QUEUE_PRESCALER 8 //Timer2 prescaler, 8, 32 or 64, the ticks of LCD_QUEUE_TICK_US must fit in 8 bits
+
+#define LCD_SHADOW_ENABLE 0 //Set to (1) to write to a copy of the screen in RAM and send only the changed characters with LCD_Flush()
+
+#define LCD_MARQUEE_ENABLE 0 //Set to (1) to scroll long texts with the display shift, using LCD_Marquee_Start() and LCD_Marquee_Tick()
+#define LCD_MARQUEE_GAP 4 //Spaces between the end and the start of a text longer than the DDRAM line
+#define LCD_DDRAM_LINE 40 //Characters of each DDRAM line, the visible ones and the ones after them
+
+#define LCD_GLYPH_ENABLE 0 //Set to (1) to place custom 5x8 characters from PROGMEM in the 8 CGRAM places with LCD_Glyph_Get() and LCD_Glyph_Put()
+
 extern void LCD_WriteInstruction(uint8_t instr); //Function to write an instruction to LCD
 extern void LCD_WriteChar(unsigned char data); //Function to write data (ASCII characters) to LCD
-extern void LCD_SetCursor(uint8_t x_position, uint8_t y_position); //Send cursor to a specific address (0-80)
+extern void LCD_SetCursor(uint8_t x_position, uint8_t y_position); //Send cursor to a column (from 0) and a row (from 1)
 extern void InitLCD(void); //LCD initialization
 extern void LCD_ClearDisplay(void); //Clear the display and reset cursor
 extern void LCD_WriteStr(char *str_data); //Write a string on the LCD
+extern void LCD_WriteStr_P(const char *str_data); //Write a string stored in PROGMEM on the LCD
+extern void LCD_WriteInt(int32_t value, uint8_t width); //Write a number, right aligned with spaces to (width) characters, (0) for no alignment
+extern void LCD_WriteFixed(int32_t value, uint8_t decimals, uint8_t width); //Write a number with (decimals) digits after the point, 253 with 1 decimal is 25.3
+#if LCD_TRANSPORT == LCD_TRANSPORT_PCF8574
+extern void LCD_Backlight_ON(void); //Turn the backlight on
+extern void LCD_Backlight_OFF(void); //Turn the backlight off
+extern uint8_t LCD_Error(void); //The first TWI error of the PCF8574 since the last call, TWI_OK if every byte reached it
+#endif
+#if LCD_QUEUE_ENABLE
+extern void LCD_Sync(void); //Wait until every byte of the queue is sent to the LCD
+extern uint8_t LCD_Queue_High_Water(void); //The most bytes that were waiting in the queue at the same time
+#endif
+#if LCD_BUSY_FLAG_ENABLE
+extern uint8_t LCD_Get_Address(void); //Wait until the LCD is ready and return its address counter, 0xFF if the busy flag can't be read
+#endif
 
 //LCD Display formating functions
 extern void LCD_AutoScroll(void); //Automatic display scrolling
@@ -50,5 +116,26 @@ extern void LCD_Text_Dir_RightToLeft(void); //Set the cursor moving direction to
 extern void LCD_Text_Dir_LeftToRight(void); //Set the cursor moving direction to the left
 extern void LCD_Scroll_Disp_Left(void); //Scroll the display once to the left
 extern void LCD_Scroll_Disp_Right(void); //Scroll the display once to the right
+extern void LCD_ReturnHome(void); //Send the cursor to the first position and undo the display shift
+
+#if LCD_MARQUEE_ENABLE
+extern void LCD_Marquee_Start(char *str_data, uint8_t y_position, uint8_t period); //Scroll the string on the DDRAM line of the row, one step every (period) ticks
+extern void LCD_Marquee_Tick(void); //Call it periodically, sends at most one step of the scrolling
+extern void LCD_Marquee_Stop(void); //Stop the scrolling and undo the display shift
+#endif
+
+#if LCD_GLYPH_ENABLE
+extern uint8_t LCD_Glyph_Get(const uint8_t *glyph); //Return the character code (8-15) of a glyph of 8 bytes in PROGMEM, written to the CGRAM if it isn't there, 0xFF if no place can be freed
+extern void LCD_Glyph_Put(const uint8_t *glyph); //Release a glyph taken with LCD_Glyph_Get(), its place can be reused when it is no longer needed
+#endif
+
+#if LCD_SHADOW_ENABLE
+//Screen copy functions, nothing is sent to the LCD until LCD_Flush() is called
+extern void LCD_Buf_SetCursor(uint8_t x_position, uint8_t y_position); //Set the position of the next character in the copy, same positions as LCD_SetCursor()
+extern void LCD_Buf_WriteChar(unsigned char data); //Write a character to the copy and move to the next position, at the end of a row it continues to the next one
+extern void LCD_Buf_WriteStr(char *str_data); //Write a string to the copy
+extern void LCD_Buf_Clear(void); //Fill the copy with spaces and move to the first position
+extern void LCD_Flush(void); //Send to the LCD only the characters that changed since the last flush
+#endif
 
 #endif
\ No newline at end of file
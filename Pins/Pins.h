@@ -0,0 +1,39 @@
+#ifndef PINS_H_
+#define PINS_H_
+
+#include "../HAL/HAL.h"
+
+/*
+* Compile time pin descriptors
+* A pin is given as its PORT letter and bit number, for example #define LCD_RS_PIN D, 2
+* The macros paste the letter to the register names, so with a constant bit each change compiles to one sbi or cbi instruction
+* and the other PINS of the PORT are never read and written back
+*/
+
+//The registers and the bit of a pin, the extra level of macros splits the expanded descriptor into its two parts
+#define PIN_PORT_REG(...) PIN_PORT_REG_(__VA_ARGS__)
+#define PIN_DDR_REG(...) PIN_DDR_REG_(__VA_ARGS__)
+#define PIN_IN_REG(...) PIN_IN_REG_(__VA_ARGS__)
+#define PIN_BIT(...) PIN_BIT_(__VA_ARGS__)
+
+#define PIN_PORT_REG_(port, bit) PORT##port
+#define PIN_DDR_REG_(port, bit) DDR##port
+#define PIN_IN_REG_(port, bit) PIN##port
+#define PIN_BIT_(port, bit) (bit)
+
+//The PORT of a pin as a number, so #if can check a pin that must have a fixed function, for example PIN_PORT_NUM(D, 6)
+#define PIN_PORT_NUM(...) PIN_PORT_NUM_(__VA_ARGS__)
+#define PIN_PORT_NUM_(port, bit) PIN_PORT_NUM_##port
+#define PIN_PORT_NUM_A 0
+#define PIN_PORT_NUM_B 1
+#define PIN_PORT_NUM_C 2
+#define PIN_PORT_NUM_D 3
+
+#define PIN_HIGH(...) (PIN_PORT_REG(__VA_ARGS__) |= (1 << PIN_BIT(__VA_ARGS__))) //Output HIGH, or pull-up resistor on for an input
+#define PIN_LOW(...) (PIN_PORT_REG(__VA_ARGS__) &= ~(1 << PIN_BIT(__VA_ARGS__))) //Output LOW, or pull-up resistor off for an input
+#define PIN_OUTPUT(...) (PIN_DDR_REG(__VA_ARGS__) |= (1 << PIN_BIT(__VA_ARGS__))) //Set the pin to output
+#define PIN_INPUT(...) (PIN_DDR_REG(__VA_ARGS__) &= ~(1 << PIN_BIT(__VA_ARGS__))) //Set the pin to input
+#define PIN_READ(...) (PIN_IN_REG(__VA_ARGS__) & (1 << PIN_BIT(__VA_ARGS__))) //Non zero if the pin is HIGH
+#define PIN_WRITE(pin, value) do { if (value) PIN_PORT_REG(pin) |= (1 << PIN_BIT(pin)); else PIN_PORT_REG(pin) &= ~(1 << PIN_BIT(pin)); } while (0) //HIGH if (value) is not zero
+
+#endif